@@ -0,0 +1,53 @@
+#!/bin/bash
+# Compare the "Total Instructions:" line of two sets of tool outputs, e.g. the
+# outputs of a new build of the tools against the committed ones:
+#
+#   ./check_total_instructions.sh /path/to/new/outputs_stats/train outputs_stats/train
+#
+# Files are matched by benchmark name (the part before ".cslab"), so the
+# output names of the two directories do not need to be the same.
+# Exits with 1 if any benchmark differs or is missing.
+#
+# The counts of a benchmark change slightly with its environment (the
+# committed train/ and outputs_stats/train/ runs differ by up to ~0.01%), so
+# compare runs of the old and new build made from the same shell and inputs.
+# The slowdown of the two builds is measured the same way, e.g.:
+#
+#   PIN_TOOL=/path/old/cslab_branch_stats.so ./run_slowdown.sh 470.lbm ""
+#   PIN_TOOL=/path/new/cslab_branch_stats.so ./run_slowdown.sh 470.lbm ""
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <new_outputs_dir> <reference_outputs_dir>"
+    exit 1
+fi
+
+newDir="$1"
+refDir="$2"
+status=0
+
+total_instructions() {
+    sed -n 's/^Total Instructions: \([0-9]*\)$/\1/p' "$1"
+}
+
+for refFile in "$refDir"/*.out; do
+    name=$(basename "$refFile")
+    BENCH="${name%%.cslab*}"
+    newFile=$(ls "$newDir/$BENCH".cslab*.out 2>/dev/null | head -n 1)
+
+    if [ -z "$newFile" ]; then
+        printf "%-16s %-8s\n" "$BENCH" "MISSING"
+        status=1
+        continue
+    fi
+
+    ref=$(total_instructions "$refFile")
+    new=$(total_instructions "$newFile")
+    if [ "$ref" == "$new" ]; then
+        printf "%-16s %-8s %s\n" "$BENCH" "OK" "$new"
+    else
+        printf "%-16s %-8s %s (reference %s, difference %d)\n" "$BENCH" "DIFF" "$new" "$ref" "$((new - ref))"
+        status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,150 @@
+#ifndef BRANCH_CONTEXT_H
+#define BRANCH_CONTEXT_H
+
+#include <list>
+#include <vector>
+#include <utility> // std::swap
+
+#include "history_register.h"
+
+/**
+ * History state that is the same for every predictor of a run, kept once
+ * instead of once per predictor:
+ *
+ *   - the global history, long enough for the longest global predictor,
+ *     and the same outcomes as +1/-1 bytes if a perceptron asks for them
+ *   - one table of local histories (16 bits each) per BHT size; predictors
+ *     with the same number of BHT entries read the same table with their own
+ *     history length, and the entry of the current branch (ip % entries) is
+ *     looked up once per branch and table
+ *
+ * Predictors use a context after BranchPredictor::attach(); all attach()
+ * calls must come before the first branch. For every conditional branch:
+ *
+ *   context.begin(ip);
+ *   ... predict() and update() of every attached predictor ...
+ *   context.end(taken);
+ *
+ * The histories only change in end(), so every attached predictor must see
+ * every branch between begin() and end(). The batched (-buffered) and
+ * -workers modes of cslab_branch run one predictor over many branches at a
+ * time and keep the per-predictor histories instead.
+ **/
+class BranchContext
+{
+public:
+    typedef HistoryRegister<16> LocalHistory;
+
+    struct LocalHistoryTable
+    {
+        explicit LocalHistoryTable(unsigned entries_) : entries(entries_), histories(entries_), current(&histories[0]) {}
+
+        unsigned entries;
+        std::vector<LocalHistory> histories;
+        LocalHistory *current; // the entry of the branch between begin() and end()
+    };
+
+    BranchContext() : global(1), global_length(1), signed_global(0) {}
+
+    // The global history, at least length bits long
+    const DynamicHistoryRegister &globalHistory(unsigned length)
+    {
+        if (length > global_length)
+        {
+            global_length = length;
+            global = DynamicHistoryRegister(length);
+        }
+        return global;
+    }
+
+    // The global history as +1/-1 bytes, at least length of them
+    const SignedHistory &signedGlobalHistory(unsigned length)
+    {
+        if (length > signed_global.getLength())
+            signed_global = SignedHistory(length);
+        return signed_global;
+    }
+
+    // The local histories of a BHT with the given number of entries
+    const LocalHistoryTable &localHistories(unsigned entries)
+    {
+        for (std::list<LocalHistoryTable>::iterator it = local.begin(); it != local.end(); ++it)
+            if (it->entries == entries)
+                return *it;
+        local.emplace_back(entries);
+        return local.back();
+    }
+
+    void begin(ADDRINT ip)
+    {
+        for (std::list<LocalHistoryTable>::iterator it = local.begin(); it != local.end(); ++it)
+            it->current = &it->histories[ip % it->entries];
+    }
+
+    void end(bool taken)
+    {
+        for (std::list<LocalHistoryTable>::iterator it = local.begin(); it != local.end(); ++it)
+            it->current->push(taken);
+        global.push(taken);
+        if (signed_global.getLength())
+            signed_global.push(taken);
+    }
+
+    // Clears every history, the tables are kept
+    void reset()
+    {
+        global = DynamicHistoryRegister(global_length);
+        signed_global = SignedHistory(signed_global.getLength());
+        for (std::list<LocalHistoryTable>::iterator it = local.begin(); it != local.end(); ++it)
+        {
+            it->histories.assign(it->entries, LocalHistory());
+            it->current = &it->histories[0];
+        }
+    }
+
+    // Exchanges the histories with a context of the same tables (a copy)
+    // without moving the tables: the attached predictors keep their
+    // references and read the other histories from now on. cslab_branch
+    // -threads shared switches between the threads this way.
+    void swap(BranchContext &other)
+    {
+        std::swap(global, other.global);
+        std::swap(signed_global, other.signed_global);
+        std::list<LocalHistoryTable>::iterator it = local.begin(), other_it = other.local.begin();
+        for (; it != local.end(); ++it, ++other_it)
+        {
+            it->histories.swap(other_it->histories);
+            std::swap(it->current, other_it->current);
+        }
+    }
+
+    // The histories, for predictor_state.h. Loading needs a context with
+    // the same tables, i.e. the same predictors attached.
+    void save(PredictorStateWriter &out) const
+    {
+        global.save(out);
+        signed_global.save(out);
+        out.put(local.size());
+        for (std::list<LocalHistoryTable>::const_iterator it = local.begin(); it != local.end(); ++it)
+            out.put(it->histories);
+    }
+
+    bool load(PredictorStateReader &in)
+    {
+        size_t num_tables;
+        if (!global.load(in) || !signed_global.load(in) || !in.get(num_tables) || num_tables != local.size())
+            return false;
+        for (std::list<LocalHistoryTable>::iterator it = local.begin(); it != local.end(); ++it)
+            if (!in.get(it->histories))
+                return false;
+        return true;
+    }
+
+private:
+    DynamicHistoryRegister global;
+    unsigned global_length;
+    SignedHistory signed_global; // length 0 (not kept) without a perceptron
+    std::list<LocalHistoryTable> local; // a list, so the references handed out stay valid
+};
+
+#endif
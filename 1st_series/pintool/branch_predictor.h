@@ -5,6 +5,17 @@
 #include <cmath>   // pow(), floor
 #include <cstring> // memset()
 #include <cstdint> // UINT64
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h> // BTB tag compare, perceptron dot product
+#endif
+
+#include "predictor_state.h"
+#include "results_output.h"
+#include "packed_counters.h"
+#include "history_register.h"
+#include "branch_context.h"
 
 /**
  * A generic BranchPredictor base class.
@@ -21,10 +32,43 @@ public:
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) = 0;
     virtual string getName() = 0;
 
+    // predict() followed by update() of the same branch, returns the
+    // prediction. Predictors override it to look their tables up only once.
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual)
+    {
+        bool predicted = predict(ip, target);
+        update(predicted, actual, ip, target);
+        return predicted;
+    }
+
+    // Read the histories from a BranchContext shared with other predictors
+    // instead of keeping them. Predictors without history ignore it.
+    virtual void attach(BranchContext &context) {}
+
     UINT64 getNumCorrectPredictions() { return correct_predictions; }
     UINT64 getNumIncorrectPredictions() { return incorrect_predictions; }
 
-    void resetCounters() { correct_predictions = incorrect_predictions = 0; };
+    virtual void resetCounters() { correct_predictions = incorrect_predictions = 0; };
+
+    // Adds the statistics of an identical predictor, e.g. the copy of another thread
+    virtual void mergeCounters(BranchPredictor &other)
+    {
+        correct_predictions += other.correct_predictions;
+        incorrect_predictions += other.incorrect_predictions;
+    }
+
+    // Checkpoint of the tables (not the statistics) for warm starts, see
+    // predictor_state.h. Both return false for a predictor that has no
+    // checkpoint support; histories kept in an attached BranchContext are
+    // saved with the context.
+    virtual bool saveState(PredictorStateWriter &out) { return false; }
+    virtual bool loadState(PredictorStateReader &in) { return false; }
+
+    // Configuration as a JSON object for the -json/-records results (see
+    // results_output.h), and the bits of predictor state it models, tables
+    // and histories. RESULTS_NONE when not modelled.
+    virtual string getParams() { return JsonObject(getName()).str(); }
+    virtual UINT64 getStorageBits() { return RESULTS_NONE; }
 
 protected:
     void updateCounters(bool predicted, bool actual)
@@ -47,17 +91,16 @@ public:
         : BranchPredictor(), index_bits(index_bits_), cntr_bits(cntr_bits_)
     {
         table_entries = 1 << index_bits;
-        TABLE = new unsigned long long[table_entries];
-        memset(TABLE, 0, table_entries * sizeof(*TABLE));
+        TABLE = new CounterTable(table_entries, cntr_bits, 0);
 
-        COUNTER_MAX = (1 << cntr_bits) - 1;
+        COUNTER_MAX = (1ULL << cntr_bits) - 1;
     };
     ~NbitPredictor() { delete TABLE; };
 
     virtual bool predict(ADDRINT ip, ADDRINT target)
     {
         unsigned int ip_table_index = ip % table_entries;
-        unsigned long long ip_table_value = TABLE[ip_table_index];
+        unsigned long long ip_table_value = TABLE->get(ip_table_index);
         unsigned long long prediction = ip_table_value >> (cntr_bits - 1);
         return (prediction != 0);
     };
@@ -65,20 +108,21 @@ public:
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
     {
         unsigned int ip_table_index = ip % table_entries;
-        if (actual)
-        {
-            if (TABLE[ip_table_index] < COUNTER_MAX)
-                TABLE[ip_table_index]++;
-        }
-        else
-        {
-            if (TABLE[ip_table_index] > 0)
-                TABLE[ip_table_index]--;
-        }
+        TABLE->update(ip_table_index, actual, COUNTER_MAX);
 
         updateCounters(predicted, actual);
     };
 
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual)
+    {
+        CounterTable::Slot counter = TABLE->slot(ip % table_entries);
+        bool predicted = (counter.get() >> (cntr_bits - 1)) != 0;
+        counter.update(actual, COUNTER_MAX);
+
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
     virtual string getName()
     {
         std::ostringstream stream;
@@ -86,12 +130,27 @@ public:
         return stream.str();
     }
 
+    virtual bool saveState(PredictorStateWriter &out)
+    {
+        TABLE->save(out);
+        return true;
+    }
+
+    virtual bool loadState(PredictorStateReader &in) { return TABLE->load(in); }
+
+    virtual string getParams()
+    {
+        return JsonObject("Nbit").add("index_bits", index_bits).add("counter_bits", cntr_bits).str();
+    }
+
+    virtual UINT64 getStorageBits() { return (UINT64)table_entries * cntr_bits; }
+
 private:
     unsigned int index_bits, cntr_bits;
-    unsigned int COUNTER_MAX;
+    unsigned long long COUNTER_MAX;
 
-    /* Make this unsigned long long so as to support big numbers of cntr_bits. */
-    unsigned long long *TABLE;
+    /* Up to 8 cntr_bits are supported (a byte per counter by default). */
+    CounterTable *TABLE;
     unsigned int table_entries;
 };
 
@@ -106,19 +165,18 @@ public:
             exit(1);
         }
         table_entries = 1 << index_bits;
-        TABLE = new uint8_t[table_entries];
-        memset(TABLE, 0, table_entries * sizeof(*TABLE));
+        TABLE = new CounterTable(table_entries, cntr_bits, 0);
     }
 
     ~FSMPredictor()
     {
-        delete[] TABLE;
+        delete TABLE;
     }
 
     bool predict(ADDRINT ip, ADDRINT target) override
     {
         unsigned int ip_table_index = ip % table_entries;
-        uint8_t ip_table_value = TABLE[ip_table_index];
+        uint8_t ip_table_value = TABLE->get(ip_table_index);
         uint8_t prediction = ip_table_value >> (cntr_bits - 1);
         return (prediction != 0);
     }
@@ -126,19 +184,30 @@ public:
     void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) override
     {
         unsigned int idx = ip % table_entries;
-        uint8_t state = TABLE[idx];
+        uint8_t state = TABLE->get(idx);
 
         unsigned int row_idx = row - 2;
         unsigned int outcome_idx = actual ? 1 : 0;
         uint8_t next_state = transitions[row_idx][outcome_idx][state];
 
         // Update the state in the table
-        TABLE[idx] = next_state;
+        TABLE->set(idx, next_state);
 
         // Update the counters
         updateCounters(predicted, actual);
     }
 
+    bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) override
+    {
+        CounterTable::Slot state = TABLE->slot(ip % table_entries);
+        uint8_t value = state.get();
+        bool predicted = (value >> (cntr_bits - 1)) != 0;
+        state.set(transitions[row - 2][actual ? 1 : 0][value]);
+
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
     std::string getName() override
     {
         std::ostringstream stream;
@@ -146,12 +215,29 @@ public:
         return stream.str();
     }
 
-private:
+    bool saveState(PredictorStateWriter &out) override
+    {
+        TABLE->save(out);
+        return true;
+    }
+
+    bool loadState(PredictorStateReader &in) override { return TABLE->load(in); }
+
+    std::string getParams() override
+    {
+        return JsonObject("FSM").add("row", row).add("index_bits", index_bits).str();
+    }
+
+    UINT64 getStorageBits() override { return (UINT64)table_entries * cntr_bits; }
+
+    // [row - 2][outcome][state], also used by PredictorSweep
     static const uint8_t transitions[4][2][4];
+
+private:
     unsigned int row;
     unsigned int table_entries;
     const unsigned index_bits, cntr_bits;
-    uint8_t *TABLE;
+    CounterTable *TABLE;
 };
 const uint8_t FSMPredictor::transitions[4][2][4] = {
     // Row 2 (row_idx=0) - [outcome][state]
@@ -169,54 +255,147 @@ const uint8_t FSMPredictor::transitions[4][2][4] = {
 };
 
 // Fill in the BTB implementation ...
+//> Replacement policy of a BTB set. LRU is exact (a timestamp per way),
+//  PLRU is a binary tree of assoc-1 bits and NRU a single bit per way.
+enum BTBReplacementPolicy
+{
+    BTB_LRU,
+    BTB_PLRU,
+    BTB_NRU
+};
+
+/**
+ * Set-associative BTB stored in one flat array. Every set is a contiguous
+ * block of 64-bit words:
+ *
+ *   [valid bits][PLRU/NRU bits][tags x assoc][targets x assoc][LRU stamps x assoc]
+ *
+ * so a lookup touches one or two cache lines and compares all the tags of
+ * the set at once (AVX2/SSE4.1 when the tool is built with them, a plain
+ * loop otherwise). Up to 64 ways.
+ **/
 class BTBPredictor : public BranchPredictor
 {
 public:
-    BTBPredictor(int btb_lines, int btb_assoc)
-        : BranchPredictor(), table_lines(btb_lines), table_assoc(btb_assoc), numSets(table_lines / table_assoc), sets(numSets, std::vector<BTBEntry>(table_assoc)),
+    BTBPredictor(int btb_lines, int btb_assoc, BTBReplacementPolicy policy_ = BTB_LRU)
+        : BranchPredictor(), table_lines(btb_lines), table_assoc(btb_assoc), numSets(table_lines / table_assoc),
+          policy(policy_), set_words(2 + table_assoc * (policy == BTB_LRU ? 3 : 2)),
+          table((size_t)numSets * set_words, 0),
           current_time(0), NumCorrectTargetPredictions(0) {}
 
     ~BTBPredictor() {}
 
     virtual bool predict(ADDRINT ip, ADDRINT target)
     {
-        int index = ip & (numSets - 1);
-        for (auto &entry : sets[index])
-        {
-            if (entry.valid && entry.ip == ip)
-                return true;
-        }
-        return false;
+        uint64_t *set = getSet(ip);
+        return (matchWays(set, ip) & set[VALID]) != 0;
     }
 
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
     {
-        int index = ip & (numSets - 1);
-        bool invalid_found = false;
-        BTBEntry *lru_entry = nullptr;
+        uint64_t *set = getSet(ip);
+        train(set, predicted ? matchWays(set, ip) : 0, predicted, actual, ip, target);
+    }
+
+    // One tag compare for both the prediction and the update
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual)
+    {
+        uint64_t *set = getSet(ip);
+        uint64_t hits = matchWays(set, ip);
+        bool predicted = (hits & set[VALID]) != 0;
+        train(set, hits, predicted, actual, ip, target);
+        return predicted;
+    }
+
+    virtual string getName()
+    {
+        std::ostringstream stream;
+        stream << "BTB-" << table_lines << "-" << table_assoc;
+        if (policy == BTB_PLRU)
+            stream << "-PLRU";
+        else if (policy == BTB_NRU)
+            stream << "-NRU";
+        return stream.str();
+    }
+
+    UINT64 getNumCorrectTargetPredictions()
+    {
+        return NumCorrectTargetPredictions;
+    }
+
+    virtual void resetCounters()
+    {
+        BranchPredictor::resetCounters();
+        NumCorrectTargetPredictions = 0;
+    }
+
+    virtual void mergeCounters(BranchPredictor &other)
+    {
+        BranchPredictor::mergeCounters(other);
+        NumCorrectTargetPredictions += static_cast<BTBPredictor &>(other).NumCorrectTargetPredictions;
+    }
+
+    // The sets and the LRU clock
+    virtual bool saveState(PredictorStateWriter &out)
+    {
+        out.put(table);
+        out.put(current_time);
+        return true;
+    }
+
+    virtual bool loadState(PredictorStateReader &in) { return in.get(table) && in.get(current_time); }
+
+    virtual string getParams()
+    {
+        static const char *policies[] = {"LRU", "PLRU", "NRU"};
+        return JsonObject("BTB").add("lines", table_lines).add("assoc", table_assoc)
+            .add("policy", policies[policy]).str();
+    }
+
+    // As simulated: a valid bit, a full 64-bit tag and target per line, and
+    // the replacement bits (log2(assoc) per line for LRU, assoc - 1 per set
+    // for PLRU, one per line for NRU)
+    virtual UINT64 getStorageBits()
+    {
+        unsigned lru_bits = 0;
+        while ((1 << lru_bits) < table_assoc)
+            lru_bits++;
+        UINT64 replacement = (policy == BTB_LRU)    ? (UINT64)table_lines * lru_bits
+                             : (policy == BTB_PLRU) ? (UINT64)numSets * (table_assoc - 1)
+                                                    : (UINT64)table_lines;
+        return (UINT64)table_lines * (1 + 64 + 64) + replacement;
+    }
+
+private:
+    // Word offsets inside a set
+    enum
+    {
+        VALID = 0,
+        BITS = 1,
+        TAGS = 2
+    };
+
+    // hits: matchWays(set, ip), only used if predicted
+    void train(uint64_t *set, uint64_t hits, bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        uint64_t *targets = set + TAGS + table_assoc;
 
         if (predicted)
         {
-            for (auto &entry : sets[index])
+            // First way with a matching tag, as the previous per-entry loop
+            if (hits)
             {
-                if (entry.ip == ip)
+                int way = lowestWay(hits);
+                if (actual)
                 {
-                    if (actual)
-                    {
-                        entry.timestamp = current_time++;
-                        if (entry.target != target)
-                            entry.target = target;
-                        else
-                            NumCorrectTargetPredictions++;
-                        break;
-                    }
-
+                    touch(set, way);
+                    if (targets[way] != target)
+                        targets[way] = target;
                     else
-                    {
-                        entry.valid = false;
-                        break;
-                    }
+                        NumCorrectTargetPredictions++;
                 }
+                else
+                    set[VALID] &= ~(1ULL << way);
             }
         }
 
@@ -224,58 +403,123 @@ public:
         {
             if (actual)
             {
-                // Insert new entry
-                for (auto &entry : sets[index])
-                {
-                    if (!entry.valid)
-                    {
-                        entry.valid = true;
-                        entry.ip = ip;
-                        entry.target = target;
-                        entry.timestamp = current_time++;
-                        invalid_found = true;
-                        break;
-                    }
-
-                    if (!lru_entry || entry.timestamp < lru_entry->timestamp)
-                        lru_entry = &entry;
-                }
-
-                if (!invalid_found)
-                {
-                    lru_entry->valid = true;
-                    lru_entry->ip = ip;
-                    lru_entry->target = target;
-                    lru_entry->timestamp = current_time++;
-                }
+                // Insert new entry, in the first invalid way if there is one
+                uint64_t invalid = ~set[VALID] & allWays();
+                int way = invalid ? lowestWay(invalid) : victim(set);
+
+                set[VALID] |= 1ULL << way;
+                set[TAGS + way] = ip;
+                targets[way] = target;
+                touch(set, way);
             }
         }
 
         updateCounters(predicted, actual);
     }
 
-    virtual string getName()
+    uint64_t *getSet(ADDRINT ip) { return &table[(size_t)(ip & (numSets - 1)) * set_words]; }
+
+    // Bitmask of the ways whose tag is ip (valid or not)
+    uint64_t matchWays(const uint64_t *set, ADDRINT ip) const
     {
-        std::ostringstream stream;
-        stream << "BTB-" << table_lines << "-" << table_assoc;
-        return stream.str();
+        const uint64_t *tags = set + TAGS;
+        uint64_t hits = 0;
+        int way = 0;
+
+#if defined(__AVX2__)
+        __m256i key = _mm256_set1_epi64x((long long)ip);
+        for (; way + 4 <= table_assoc; way += 4)
+        {
+            __m256i t = _mm256_loadu_si256((const __m256i *)(tags + way));
+            __m256i eq = _mm256_cmpeq_epi64(t, key);
+            hits |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << way;
+        }
+#elif defined(__SSE4_1__)
+        __m128i key = _mm_set1_epi64x((long long)ip);
+        for (; way + 2 <= table_assoc; way += 2)
+        {
+            __m128i t = _mm_loadu_si128((const __m128i *)(tags + way));
+            __m128i eq = _mm_cmpeq_epi64(t, key);
+            hits |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << way;
+        }
+#endif
+        for (; way < table_assoc; way++)
+            hits |= (uint64_t)(tags[way] == ip) << way;
+        return hits;
     }
 
-    UINT64 getNumCorrectTargetPredictions()
+    static int lowestWay(uint64_t mask) { return __builtin_ctzll(mask); }
+
+    uint64_t allWays() const { return (table_assoc == 64) ? ~0ULL : ((1ULL << table_assoc) - 1); }
+
+    // Marks way as the most recently used of the set
+    void touch(uint64_t *set, int way)
     {
-        return NumCorrectTargetPredictions;
+        switch (policy)
+        {
+        case BTB_LRU:
+            set[TAGS + 2 * table_assoc + way] = current_time++;
+            break;
+        case BTB_PLRU:
+        {
+            // Tree nodes 1..assoc-1, leaves assoc..2*assoc-1. Every node on
+            // the path points away from the accessed leaf (1 = right).
+            for (unsigned node = table_assoc + way; node > 1; node >>= 1)
+            {
+                if (node & 1)
+                    set[BITS] &= ~(1ULL << (node >> 1));
+                else
+                    set[BITS] |= 1ULL << (node >> 1);
+            }
+            break;
+        }
+        case BTB_NRU:
+            set[BITS] |= 1ULL << way;
+            if (set[BITS] == allWays())
+                set[BITS] = 1ULL << way;
+            break;
+        }
     }
 
-private:
-    int table_lines, table_assoc, numSets;
-    struct BTBEntry
+    // Way to replace in a full set
+    int victim(const uint64_t *set) const
     {
-        bool valid = false;
-        ADDRINT ip = 0;
-        ADDRINT target = 0;
-        uint64_t timestamp = 0;
-    };
-    std::vector<std::vector<BTBEntry>> sets;
+        switch (policy)
+        {
+        case BTB_PLRU:
+        {
+            unsigned node = 1;
+            while (node < (unsigned)table_assoc)
+                node = 2 * node + ((set[BITS] >> node) & 1);
+            return node - table_assoc;
+        }
+        case BTB_NRU:
+        {
+            uint64_t not_recent = ~set[BITS] & allWays();
+            return not_recent ? lowestWay(not_recent) : 0;
+        }
+        default:
+        {
+            const uint64_t *stamps = set + TAGS + 2 * table_assoc;
+            uint64_t oldest = stamps[0];
+            int lru = 0;
+            for (int way = 1; way < table_assoc; way++)
+            {
+                // Written so that it compiles to conditional moves, the
+                // oldest way is random and a branch would mispredict
+                bool older = stamps[way] < oldest;
+                oldest = older ? stamps[way] : oldest;
+                lru = older ? way : lru;
+            }
+            return lru;
+        }
+        }
+    }
+
+    int table_lines, table_assoc, numSets;
+    BTBReplacementPolicy policy;
+    int set_words;
+    std::vector<uint64_t> table;
     uint64_t current_time;
     UINT64 NumCorrectTargetPredictions;
 };
@@ -310,6 +554,13 @@ public:
     {
         return "Static-AlwaysTaken";
     }
+
+    // No state to checkpoint
+    virtual bool saveState(PredictorStateWriter &out) { return true; }
+    virtual bool loadState(PredictorStateReader &in) { return true; }
+
+    virtual string getParams() { return JsonObject("StaticAlwaysTaken").str(); }
+    virtual UINT64 getStorageBits() { return 0; }
 };
 
 class StaticBTFNTPredictor : public BranchPredictor
@@ -334,6 +585,12 @@ public:
         stream << "BTFNT";
         return stream.str();
     }
+
+    virtual bool saveState(PredictorStateWriter &out) { return true; }
+    virtual bool loadState(PredictorStateReader &in) { return true; }
+
+    virtual string getParams() { return JsonObject("BTFNT").str(); }
+    virtual UINT64 getStorageBits() { return 0; }
 };
 
 class GlobalHistoryPredictor : public BranchPredictor
@@ -344,46 +601,72 @@ private:
     const unsigned int bhr_length;  // Μήκος Global BHR (N bits)
 
     // Πίνακας PHT
-    std::vector<uint8_t> PHT; // Pattern History Table (κρατάει X-bit μετρητές)
+    CounterTable PHT; // Pattern History Table (κρατάει X-bit μετρητές, X <= 8)
 
     // Καθολικός Καταχωρητής Ιστορικού
-    uint8_t BHR; // Branch History Register (κρατάει N bits ιστορικού)
+    DynamicHistoryRegister BHR; // Branch History Register (κρατάει N bits ιστορικού, το νεότερο στο bit 0)
+    const DynamicHistoryRegister *history; // Ο BHR, ή ο κοινός καθολικός ιστορικός μετά το attach()
+    FoldedHistory BHR_folded;   // Ο BHR διπλωμένος (XOR) στα bits του δείκτη PHT, όταν N > log2(Z)
 
     // Μάσκες και όρια
     const uint8_t counter_max;         // Μέγιστη τιμή μετρητή (2^X - 1)
-    const uint8_t bhr_mask;            // Μάσκα για τον BHR (2^N - 1)
     const unsigned int pht_index_mask; // Μάσκα για τον δείκτη PHT (Z-1)
     const unsigned int pht_index_bits; // Αριθμός bits για τον δείκτη PHT
 
+    // Δείκτης PHT: PC και BHR όταν το ιστορικό χωράει στον δείκτη,
+    // αλλιώς μόνο ο διπλωμένος BHR
+    unsigned int index(ADDRINT ip) const
+    {
+        if (bhr_length > pht_index_bits)
+            return BHR_folded.value;
+
+        // Ολίσθηση του PC component για να κάνει χώρο για τα BHR bits
+        unsigned int shifted_pc_component = ip << bhr_length;
+        return (shifted_pc_component | history->recent(bhr_length)) & pht_index_mask;
+    }
+
+    // Ενημέρωσε τον καθολικό BHR (και τον διπλωμένο πριν την ολίσθηση)
+    void updateHistory(bool actual)
+    {
+        if (bhr_length > pht_index_bits)
+            BHR_folded.update(*history, actual);
+        if (history == &BHR)
+            BHR.push(actual);
+    }
+
 public:
     // Constructor
     GlobalHistoryPredictor(unsigned int pht_entries_Z, unsigned int counter_length_X, unsigned int bhr_length_N) : BranchPredictor(),
                                                                                                                    pht_entries(pht_entries_Z),
                                                                                                                    cntr_bits(counter_length_X),
                                                                                                                    bhr_length(bhr_length_N),
-                                                                                                                   BHR(0), // Αρχικοποίηση BHR σε 0
+                                                                                                                   PHT(pht_entries_Z, counter_length_X, 1), // Αρχική κατάσταση: Weakly Not Taken (1)
+                                                                                                                   BHR(bhr_length_N), // Αρχικοποίηση BHR σε 0
+                                                                                                                   history(&BHR),
                                                                                                                    counter_max((1 << counter_length_X) - 1),
-                                                                                                                   bhr_mask((1 << bhr_length_N) - 1),
                                                                                                                    pht_index_mask(pht_entries_Z - 1),
                                                                                                                    pht_index_bits(static_cast<unsigned int>(std::round(std::log2(pht_entries_Z))))
     {
-        // Αρχικοποίηση PHT (μέγεθος Z)
-        PHT.assign(pht_entries, 1); // Αρχική κατάσταση: Weakly Not Taken (1)
+        BHR_folded.init(bhr_length, pht_index_bits);
     }
 
     ~GlobalHistoryPredictor() {};
 
+    // Κοινός καθολικός ιστορικός: τον ενημερώνει το BranchContext στο end()
+    void attach(BranchContext &context) override
+    {
+        history = &context.globalHistory(bhr_length);
+        BHR = DynamicHistoryRegister(1);
+    }
+
     // Μέθοδος πρόβλεψης
     bool predict(ADDRINT ip, ADDRINT target) override
     {
-        // Ολίσθηση του PC component για να κάνει χώρο για τα BHR bits
-        unsigned int shifted_pc_component = ip << bhr_length;
-
         // Υπολογισμός του δείκτη PHT χρησιμοποιώντας το BHR
-        unsigned int pht_index = (shifted_pc_component | BHR) & pht_index_mask;
+        unsigned int pht_index = index(ip);
 
         // Διάβασε τον X-bit μετρητή από τον PHT
-        uint8_t counter_state = PHT[pht_index];
+        uint8_t counter_state = PHT.get(pht_index);
 
         // Κάνε την πρόβλεψη
         uint8_t prediction = counter_state >> (cntr_bits - 1);
@@ -393,33 +676,30 @@ public:
     // Μέθοδος ενημέρωσης
     void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) override
     {
-        // Ολίσθηση του PC component για να κάνει χώρο για τα BHR bits
-        unsigned int shifted_pc_component = ip << bhr_length;
-
         // Υπολογισμός του δείκτη PHT χρησιμοποιώντας το BHR
-        unsigned int pht_index = (shifted_pc_component | BHR) & pht_index_mask;
+        unsigned int pht_index = index(ip);
 
         // 2. Ενημέρωσε τον X-bit μετρητή στον PHT
-        uint8_t old_counter_state = PHT[pht_index];
-        uint8_t new_counter_state;
-        if (actual) // Branch Taken
-        {
-            new_counter_state = (old_counter_state < counter_max) ? old_counter_state + 1 : counter_max;
-        }
-        else // Branch Not Taken
-        {
-            new_counter_state = (old_counter_state > 0) ? old_counter_state - 1 : 0;
-        }
-        PHT[pht_index] = new_counter_state;
+        PHT.update(pht_index, actual, counter_max);
 
-        unsigned int bhr_update_mask = (1 << (bhr_length - 1)); // Μάσκα για την ενημέρωση του BHR
-        // Ενημέρωσε τον καθολικό BHR
-        BHR = ((BHR >> 1) | ((actual) ? bhr_update_mask : 0)) & bhr_mask;
+        updateHistory(actual);
 
         // Ενημέρωσε τους γενικούς μετρητές της βασικής κλάσης
         updateCounters(predicted, actual);
     }
 
+    // Πρόβλεψη και ενημέρωση με έναν υπολογισμό δείκτη και μία πρόσβαση στον PHT
+    bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) override
+    {
+        CounterTable::Slot counter = PHT.slot(index(ip));
+        bool predicted = (counter.get() >> (cntr_bits - 1)) != 0;
+        counter.update(actual, counter_max);
+
+        updateHistory(actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
     // Μέθοδος για το όνομα του predictor
     std::string getName() override
     {
@@ -430,6 +710,29 @@ public:
                << "-" << (pht_entries / 1024) << "KPHT"; // PHT Entries (Z in K)
         return stream.str();
     }
+
+    // PHT, BHR (κενός μετά το attach()) και διπλωμένος BHR
+    bool saveState(PredictorStateWriter &out) override
+    {
+        PHT.save(out);
+        BHR.save(out);
+        out.put(BHR_folded.value);
+        return true;
+    }
+
+    bool loadState(PredictorStateReader &in) override
+    {
+        return PHT.load(in) && BHR.load(in) && in.get(BHR_folded.value);
+    }
+
+    // Παράμετροι Z, X, N και αποθηκευτικός χώρος Z * X + N bits
+    std::string getParams() override
+    {
+        return JsonObject("Global").add("pht_entries", pht_entries).add("counter_bits", cntr_bits)
+            .add("bhr_length", bhr_length).str();
+    }
+
+    UINT64 getStorageBits() override { return (UINT64)pht_entries * cntr_bits + bhr_length; }
 };
 
 class LocalHistoryPredictor : public BranchPredictor
@@ -442,15 +745,22 @@ private:
     const unsigned int pht_counter_bits; // Bits ανά μετρητή PHT (σταθερό 2)
     const unsigned int pht_index_mask;   // Μάσκα για τον δείκτη PHT (8192 - 1)
 
-    // Μάσκα για το ιστορικό (για να κρατάμε μόνο Z bits)
-    const uint8_t history_mask;
     // Πίνακες
-    std::vector<uint8_t> BHT; // Branch History Table (κρατάει Z bits ιστορικού)
-    std::vector<uint8_t> PHT; // Pattern History Table (κρατάει 2-bit μετρητές)
+    std::vector<HistoryRegister<16>> BHT; // Branch History Table (κρατάει Z <= 16 bits ιστορικού)
+    const BranchContext::LocalHistoryTable *shared_BHT; // Κοινός BHT μετά το attach(), αλλιώς NULL
 
     // Όριο για τον 2-bit μετρητή
     const uint8_t counter_max = 3; // (1 << pht_counter_bits) - 1;
-    const unsigned int bht_length; // Μήκος BHT (log2(X))
+
+    CounterTable PHT; // Pattern History Table (κρατάει 2-bit μετρητές)
+
+    // Δείκτης PHT από το PC και το τοπικό ιστορικό της εντολής
+    unsigned int index(ADDRINT ip, const HistoryRegister<16> &local_history) const
+    {
+        // Ολίσθηση του PC component για να κάνει χώρο για τα Z bits του local history
+        unsigned int shifted_pc_component = ip << history_length;
+        return (shifted_pc_component | local_history.recent(history_length)) & pht_index_mask;
+    }
 
 public:
     // Constructor
@@ -460,32 +770,33 @@ public:
                                                                                        pht_entries(pht_entries),
                                                                                        pht_counter_bits(pht_counter_bits),
                                                                                        pht_index_mask(pht_entries - 1),
-                                                                                       history_mask((1 << history_length_Z) - 1), // Υπολογισμός μάσκας
-                                                                                       bht_length(static_cast<unsigned int>(std::round(std::log2(bht_entries_X))))
+                                                                                       // Αρχικοποίηση PHT (μέγεθος 8192), Weakly Not Taken (1) ως αρχική κατάσταση
+                                                                                       shared_BHT(NULL),
+                                                                                       PHT(pht_entries, 2, 1)
     {
         // Αρχικοποίηση BHT με μηδενικά (μέγεθος Χ)
-        BHT.assign(bht_entries, 0);
-
-        // Αρχικοποίηση PHT με 0 ή 1 (μέγεθος 8192)
-        // Ας πούμε Weakly Not Taken (1) ως αρχική κατάσταση
-        PHT.assign(pht_entries, 1);
+        BHT.assign(bht_entries, HistoryRegister<16>());
     }
 
     ~LocalHistoryPredictor() {};
 
-    bool predict(ADDRINT ip, ADDRINT target) override
+    // Κοινός BHT με όσους Local predictors έχουν X εγγραφές: το BranchContext
+    // βρίσκει την εγγραφή της εντολής στο begin() και την ενημερώνει στο end()
+    void attach(BranchContext &context) override
     {
-        unsigned int bht_index = ip % bht_entries;
-        uint8_t local_history = BHT[bht_index];
+        shared_BHT = &context.localHistories(bht_entries);
+        std::vector<HistoryRegister<16>>().swap(BHT);
+    }
 
-        // Ολίσθηση του PC component για να κάνει χώρο για τα local history bits
-        unsigned int shifted_pc_component = ip << bht_length;
+    bool predict(ADDRINT ip, ADDRINT target) override
+    {
+        const HistoryRegister<16> &local_history = shared_BHT ? *shared_BHT->current : BHT[ip % bht_entries];
 
         // Υπολογισμός του δείκτη PHT χρησιμοποιώντας το local history
-        unsigned int pht_index = (shifted_pc_component | local_history) & pht_index_mask;
+        unsigned int pht_index = index(ip, local_history);
 
         // Διάβασε τον 2-bit μετρητή από τον PHT
-        uint8_t counter_state = PHT[pht_index];
+        uint8_t counter_state = PHT.get(pht_index);
 
         // Κάνε την πρόβλεψη (Taken αν >= 2)
         bool prediction = (counter_state >= 2);
@@ -495,36 +806,44 @@ public:
     // Μέθοδος ενημέρωσης
     void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) override
     {
+        if (shared_BHT)
+        {
+            // Το κοινό ιστορικό ενημερώνεται από το BranchContext
+            PHT.update(index(ip, *shared_BHT->current), actual, counter_max);
+            updateCounters(predicted, actual);
+            return;
+        }
+
         // Υπολόγισε δείκτη BHT
         unsigned int bht_index = ip % bht_entries;
 
-        // Διάβασε το τοπικό ιστορικό (που χρησιμοποιήθηκε για την πρόβλεψη)
-        uint8_t local_history = BHT[bht_index];
-
-        // Ολίσθηση του PC component για να κάνει χώρο για τα local history bits
-        unsigned int shifted_pc_component = ip << bht_length;
+        // Το τοπικό ιστορικό (που χρησιμοποιήθηκε για την πρόβλεψη)
+        HistoryRegister<16> &local_history = BHT[bht_index];
 
         // Υπολογισμός του δείκτη PHT χρησιμοποιώντας το local history
-        unsigned int pht_index = (shifted_pc_component | local_history) & pht_index_mask;
+        unsigned int pht_index = index(ip, local_history);
 
         // Ενημέρωσε τον 2-bit μετρητή στον PHT
-        uint8_t old_counter_state = PHT[pht_index];
-        uint8_t new_counter_state;
-        if (actual)
-        {
-            new_counter_state = (old_counter_state < counter_max) ? old_counter_state + 1 : counter_max;
-        }
-        else
-        {
-            new_counter_state = (old_counter_state > 0) ? old_counter_state - 1 : 0;
-        }
-        PHT[pht_index] = new_counter_state;
+        PHT.update(pht_index, actual, counter_max);
+
+        // Ενημέρωσε το τοπικό ιστορικό
+        local_history.push(actual);
+
+        updateCounters(predicted, actual);
+    }
 
-        unsigned int bht_update_mask = (1 << (bht_length - 1));
-        uint8_t new_history = ((local_history >> 1) | (actual ? bht_update_mask : 0)) & history_mask;
-        BHT[bht_index] = new_history;
+    // Πρόβλεψη και ενημέρωση με μία ανάγνωση του BHT και μία πρόσβαση στον PHT
+    bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) override
+    {
+        HistoryRegister<16> *own_history = shared_BHT ? NULL : &BHT[ip % bht_entries];
+        CounterTable::Slot counter = PHT.slot(index(ip, own_history ? *own_history : *shared_BHT->current));
+        bool predicted = counter.get() >= 2;
+        counter.update(actual, counter_max);
 
+        if (own_history)
+            own_history->push(actual);
         updateCounters(predicted, actual);
+        return predicted;
     }
 
     // Μέθοδος για το όνομα του predictor
@@ -534,6 +853,29 @@ public:
         stream << "Local-" << bht_entries << "ent-" << history_length << "hist";
         return stream.str();
     }
+
+    // BHT (κενός μετά το attach()) και PHT
+    bool saveState(PredictorStateWriter &out) override
+    {
+        out.put(BHT);
+        PHT.save(out);
+        return true;
+    }
+
+    bool loadState(PredictorStateReader &in) override { return in.get(BHT) && PHT.load(in); }
+
+    // Αποθηκευτικός χώρος: X * Z bits ιστορικού και οι μετρητές του PHT,
+    // που είναι πάντα 2-bit όποιο κι αν είναι το pht_counter_bits
+    std::string getParams() override
+    {
+        return JsonObject("Local").add("bht_entries", bht_entries).add("history_length", history_length)
+            .add("pht_entries", pht_entries).add("counter_bits", pht_counter_bits).str();
+    }
+
+    UINT64 getStorageBits() override
+    {
+        return (UINT64)bht_entries * history_length + (UINT64)pht_entries * 2;
+    }
 };
 
 class TournamentHybridPredictor : public BranchPredictor
@@ -541,22 +883,27 @@ class TournamentHybridPredictor : public BranchPredictor
 public:
     TournamentHybridPredictor(unsigned int index_bits_, BranchPredictor *p1, BranchPredictor *p2) : BranchPredictor(), index_bits(index_bits_), predictor1(p1), predictor2(p2), table_entries(1 << index_bits)
     {
-        TABLE = new unsigned long long[table_entries];
         COUNTER_MAX = 3;
-        memset(TABLE, 0, table_entries * sizeof(*TABLE));
+        TABLE = new CounterTable(table_entries, 2, 0);
     }
 
     ~TournamentHybridPredictor()
     {
-        delete[] TABLE;
+        delete TABLE;
         delete predictor1;
         delete predictor2;
     }
 
+    virtual void attach(BranchContext &context)
+    {
+        predictor1->attach(context);
+        predictor2->attach(context);
+    }
+
     virtual bool predict(ADDRINT ip, ADDRINT target)
     {
         unsigned int ip_table_index = ip % table_entries;
-        unsigned long long ip_table_value = TABLE[ip_table_index];
+        unsigned long long ip_table_value = TABLE->get(ip_table_index);
         unsigned long long prediction_bit = (ip_table_value >> 1) & 1;
 
         if (prediction_bit)
@@ -572,16 +919,37 @@ public:
 
         if (prediction1 != prediction2)
         {
-            if (prediction1 == actual && (TABLE[ip_table_index] > 0))
-                TABLE[ip_table_index]--;
-            else if (TABLE[ip_table_index] < COUNTER_MAX)
-                TABLE[ip_table_index]++;
+            unsigned long long ip_table_value = TABLE->get(ip_table_index);
+            if (prediction1 == actual && (ip_table_value > 0))
+                TABLE->set(ip_table_index, ip_table_value - 1);
+            else if (ip_table_value < COUNTER_MAX)
+                TABLE->set(ip_table_index, ip_table_value + 1);
         }
         predictor1->update(prediction1, actual, ip, target);
         predictor2->update(prediction2, actual, ip, target);
         updateCounters(predicted, actual);
     }
 
+    // Each component looks its tables up once, nested hybrids included
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual)
+    {
+        CounterTable::Slot chooser = TABLE->slot(ip % table_entries);
+        unsigned long long ip_table_value = chooser.get();
+        bool prediction1 = predictor1->predictAndUpdate(ip, target, actual);
+        bool prediction2 = predictor2->predictAndUpdate(ip, target, actual);
+        bool predicted = ((ip_table_value >> 1) & 1) ? prediction2 : prediction1;
+
+        if (prediction1 != prediction2)
+        {
+            if (prediction1 == actual && (ip_table_value > 0))
+                chooser.set(ip_table_value - 1);
+            else if (ip_table_value < COUNTER_MAX)
+                chooser.set(ip_table_value + 1);
+        }
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
     virtual string getName()
     {
         std::ostringstream stream;
@@ -589,12 +957,39 @@ public:
         return stream.str();
     }
 
+    // The chooser, then the components in the same section
+    virtual bool saveState(PredictorStateWriter &out)
+    {
+        TABLE->save(out);
+        return predictor1->saveState(out) && predictor2->saveState(out);
+    }
+
+    virtual bool loadState(PredictorStateReader &in)
+    {
+        return TABLE->load(in) && predictor1->loadState(in) && predictor2->loadState(in);
+    }
+
+    // The chooser and the components, nested
+    virtual string getParams()
+    {
+        return JsonObject("Tournament").add("index_bits", index_bits)
+            .addRaw("predictor1", predictor1->getParams()).addRaw("predictor2", predictor2->getParams()).str();
+    }
+
+    virtual UINT64 getStorageBits()
+    {
+        UINT64 bits1 = predictor1->getStorageBits(), bits2 = predictor2->getStorageBits();
+        if (bits1 == RESULTS_NONE || bits2 == RESULTS_NONE)
+            return RESULTS_NONE;
+        return (UINT64)table_entries * 2 + bits1 + bits2;
+    }
+
 private:
     unsigned int index_bits;
     BranchPredictor *predictor1;
     BranchPredictor *predictor2;
     unsigned int table_entries;
-    unsigned long long *TABLE;
+    CounterTable *TABLE;
     unsigned int COUNTER_MAX;
 };
 
@@ -610,6 +1005,473 @@ public:
         stream << "Alpha21264";
         return stream.str();
     }
+
+    // Fixed configuration, the storage is that of the tournament
+    virtual string getParams() { return JsonObject("Alpha21264").str(); }
+};
+
+/**
+ * TAGE: a bimodal base predictor plus num_tables partially tagged tables
+ * indexed with the PC and geometrically longer global histories (min_hist
+ * ... max_hist bits). The longest matching table provides the prediction.
+ * Index and tag hashes use folded histories, so the cost per branch does not
+ * depend on the history length.
+ *
+ * Storage: 2^base_bits * 2 + num_tables * 2^table_bits * (1 + tag_bits + 3 + 2)
+ * bits (valid bit, tag, counter, useful bits), e.g.
+ *   TagePredictor(12, 4, 9, 7, 5, 130)    34K bits
+ *   TagePredictor(13, 6, 9, 11, 4, 300)   67K bits
+ **/
+class TagePredictor : public BranchPredictor
+{
+public:
+    TagePredictor(unsigned base_bits_, unsigned num_tables_, unsigned table_bits_, unsigned tag_bits_,
+                  unsigned min_hist_, unsigned max_hist_)
+        : BranchPredictor(), base_bits(base_bits_), num_tables(num_tables_), table_bits(table_bits_),
+          tag_bits(tag_bits_), min_hist(min_hist_), max_hist(max_hist_),
+          base(1u << base_bits_, 2, 1), tables(num_tables_), hist_len(num_tables_),
+          own_history(max_hist_), history(&own_history), index_fold(num_tables_), tag_fold1(num_tables_), tag_fold2(num_tables_),
+          lookup_ip(0), lookup_valid(false), indices(num_tables_), tags(num_tables_),
+          use_alt_on_na(0), reset_msb(true), tick(0), seed(1)
+    {
+        // Geometric history lengths: min_hist * (max_hist / min_hist)^(i / (num_tables - 1))
+        for (unsigned i = 0; i < num_tables; i++)
+        {
+            double ratio = (num_tables > 1) ? (double)i / (num_tables - 1) : 0.0;
+            hist_len[i] = (unsigned)(min_hist * std::pow((double)max_hist / min_hist, ratio) + 0.5);
+            tables[i].assign(1u << table_bits, tage_entry_t());
+            index_fold[i].init(hist_len[i], table_bits);
+            tag_fold1[i].init(hist_len[i], tag_bits);
+            tag_fold2[i].init(hist_len[i], tag_bits - 1);
+        }
+    }
+
+    ~TagePredictor() {}
+
+    virtual void attach(BranchContext &context)
+    {
+        history = &context.globalHistory(max_hist);
+        own_history = DynamicHistoryRegister(1);
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target)
+    {
+        lookup(ip);
+        return tage_pred;
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        // Nothing changes between predict() and update() of the same branch
+        if (!lookup_valid || lookup_ip != ip)
+            lookup(ip);
+        lookup_valid = false;
+
+        if (provider >= 0)
+        {
+            tage_entry_t &entry = tables[provider][indices[provider]];
+
+            // Learn whether a newly allocated (weak) entry is worth trusting
+            if (weakCounter(entry.ctr) && provider_pred != alt_pred)
+            {
+                if (alt_pred == actual && use_alt_on_na < 7)
+                    use_alt_on_na++;
+                else if (alt_pred != actual && use_alt_on_na > -8)
+                    use_alt_on_na--;
+            }
+
+            if (provider_pred != alt_pred)
+            {
+                if (provider_pred == actual && entry.u < 3)
+                    entry.u++;
+                else if (provider_pred != actual && entry.u > 0)
+                    entry.u--;
+            }
+            updateCounter(entry.ctr, actual);
+        }
+        else
+            base.update(ip & ((1u << base_bits) - 1), actual, 3);
+
+        // On a misprediction allocate an entry in a longer table
+        if (tage_pred != actual && provider < (int)num_tables - 1)
+            allocate(actual);
+
+        // Periodically age the useful bits, alternately the high and low bit
+        if ((++tick & ((1u << 18) - 1)) == 0)
+        {
+            for (unsigned i = 0; i < num_tables; i++)
+                for (size_t j = 0; j < tables[i].size(); j++)
+                    tables[i][j].u &= reset_msb ? 1 : 2;
+            reset_msb = !reset_msb;
+        }
+
+        updateHistory(actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual string getName()
+    {
+        std::ostringstream stream;
+        stream << "TAGE-" << num_tables << "x" << (1u << table_bits)
+               << "-B" << (1u << base_bits) << "-H" << min_hist << "-" << max_hist;
+        return stream.str();
+    }
+
+    virtual bool saveState(PredictorStateWriter &out)
+    {
+        base.save(out);
+        for (unsigned i = 0; i < num_tables; i++)
+            out.put(tables[i]);
+        own_history.save(out);
+        out.put(index_fold);
+        out.put(tag_fold1);
+        out.put(tag_fold2);
+        out.put(use_alt_on_na);
+        out.put(reset_msb);
+        out.put(tick);
+        out.put(seed);
+        return true;
+    }
+
+    virtual bool loadState(PredictorStateReader &in)
+    {
+        lookup_valid = false;
+        bool ok = base.load(in);
+        for (unsigned i = 0; i < num_tables && ok; i++)
+            ok = in.get(tables[i]);
+        return ok && own_history.load(in) && in.get(index_fold) && in.get(tag_fold1) && in.get(tag_fold2) &&
+               in.get(use_alt_on_na) && in.get(reset_msb) && in.get(tick) && in.get(seed);
+    }
+
+    virtual string getParams()
+    {
+        return JsonObject("TAGE").add("base_bits", base_bits).add("num_tables", num_tables)
+            .add("table_bits", table_bits).add("tag_bits", tag_bits)
+            .add("min_hist", min_hist).add("max_hist", max_hist).str();
+    }
+
+    // The formula above, plus the global history
+    virtual UINT64 getStorageBits()
+    {
+        return ((UINT64)2 << base_bits) + ((UINT64)num_tables << table_bits) * (1 + tag_bits + 3 + 2) + max_hist;
+    }
+
+private:
+    struct tage_entry_t
+    {
+        tage_entry_t() : tag(0), ctr(0), u(0), valid(false) {}
+        uint16_t tag;
+        int8_t ctr; // 3-bit signed counter, taken if >= 0
+        uint8_t u;  // 2-bit useful counter
+        bool valid; // allocated once, so an empty entry never matches a tag
+    };
+
+    static bool weakCounter(int8_t ctr) { return ctr == 0 || ctr == -1; }
+
+    static void updateCounter(int8_t &ctr, bool taken)
+    {
+        if (taken && ctr < 3)
+            ctr++;
+        else if (!taken && ctr > -4)
+            ctr--;
+    }
+
+    // Computes the table indices/tags of ip, the provider and the prediction
+    void lookup(ADDRINT ip)
+    {
+        lookup_ip = ip;
+        lookup_valid = true;
+        provider = alt = -1;
+        for (unsigned i = 0; i < num_tables; i++)
+        {
+            UINT64 pc = ip;
+            indices[i] = (unsigned)(pc ^ (pc >> (table_bits - (i % table_bits))) ^ index_fold[i].value) &
+                         ((1u << table_bits) - 1);
+            tags[i] = (unsigned)(pc ^ tag_fold1[i].value ^ (tag_fold2[i].value << 1)) & ((1u << tag_bits) - 1);
+        }
+        for (int i = num_tables - 1; i >= 0; i--)
+        {
+            const tage_entry_t &entry = tables[i][indices[i]];
+            if (!entry.valid || entry.tag != tags[i])
+                continue;
+            if (provider < 0)
+                provider = i;
+            else
+            {
+                alt = i;
+                break;
+            }
+        }
+
+        bool base_pred = base.get(ip & ((1u << base_bits) - 1)) >= 2;
+        alt_pred = (alt >= 0) ? tables[alt][indices[alt]].ctr >= 0 : base_pred;
+        if (provider < 0)
+        {
+            provider_pred = tage_pred = base_pred;
+            return;
+        }
+        const tage_entry_t &entry = tables[provider][indices[provider]];
+        provider_pred = entry.ctr >= 0;
+        tage_pred = (weakCounter(entry.ctr) && use_alt_on_na >= 0) ? alt_pred : provider_pred;
+    }
+
+    void allocate(bool actual)
+    {
+        unsigned start = provider + 1;
+
+        // Skip one free candidate at random, so that two branches fighting
+        // for the same entries do not always evict each other
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if ((seed & 1) && start + 1 < num_tables && tables[start + 1][indices[start + 1]].u == 0)
+            start++;
+
+        for (unsigned i = start; i < num_tables; i++)
+        {
+            tage_entry_t &entry = tables[i][indices[i]];
+            if (entry.u == 0)
+            {
+                entry.tag = tags[i];
+                entry.ctr = actual ? 0 : -1;
+                entry.valid = true;
+                return;
+            }
+        }
+        for (unsigned i = provider + 1; i < num_tables; i++)
+            if (tables[i][indices[i]].u > 0)
+                tables[i][indices[i]].u--;
+    }
+
+    void updateHistory(bool taken)
+    {
+        for (unsigned i = 0; i < num_tables; i++)
+        {
+            bool out = history->bit(hist_len[i] - 1);
+            index_fold[i].update(taken, out);
+            tag_fold1[i].update(taken, out);
+            tag_fold2[i].update(taken, out);
+        }
+        if (history == &own_history)
+            own_history.push(taken);
+    }
+
+    const unsigned base_bits, num_tables, table_bits, tag_bits, min_hist, max_hist;
+
+    CounterTable base; // bimodal 2-bit counters, start weakly not taken
+    std::vector<std::vector<tage_entry_t>> tables;
+    std::vector<unsigned> hist_len;
+
+    DynamicHistoryRegister own_history;     // global history, unless attach()ed to a context
+    const DynamicHistoryRegister *history; // own_history or the context's
+    std::vector<FoldedHistory> index_fold, tag_fold1, tag_fold2;
+
+    // Result of the last lookup()
+    ADDRINT lookup_ip;
+    bool lookup_valid;
+    std::vector<unsigned> indices, tags;
+    int provider, alt;
+    bool provider_pred, alt_pred, tage_pred;
+
+    int8_t use_alt_on_na; // 4-bit signed, use the alternate prediction if >= 0
+    bool reset_msb;
+    unsigned tick;
+    uint32_t seed;
+};
+
+/**
+ * Perceptron predictor (Jimenez & Lin): a row of signed 8-bit weights per
+ * PC (ip % num_rows), dotted with the last hist_len global outcomes as +1/-1.
+ * Predicts taken if the sum is >= 0 and trains when it mispredicts or the
+ * sum is within the threshold 1.93 * hist_len + 14.
+ *
+ * The history is kept as +1/-1 bytes (a SignedHistory, the BranchContext's
+ * once attached), so the dot product and the weight update are 32 (AVX2)
+ * or 16 (SSE4.1) weights per instruction. Rows are padded to
+ * 32 weights; the padding weights stay 0.
+ *
+ * Storage: num_rows * (hist_len + 1) * 8 bits, e.g.
+ *   PerceptronPredictor(128, 31)    32K bits
+ *   PerceptronPredictor(128, 63)    64K bits
+ **/
+class PerceptronPredictor : public BranchPredictor
+{
+public:
+    PerceptronPredictor(unsigned num_rows_, unsigned hist_len_)
+        : BranchPredictor(), num_rows(num_rows_), hist_len(hist_len_),
+          row_len((hist_len_ + 31) & ~31u), theta((int)(1.93 * hist_len_ + 14)),
+          weights((size_t)num_rows_ * row_len, 0), bias(num_rows_, 0),
+          mask(row_len, 0), own_history(row_len), history(&own_history),
+          lookup_ip(0), lookup_valid(false), sum(0)
+    {
+        for (unsigned i = 0; i < hist_len; i++)
+            mask[i] = -1;
+    }
+
+    ~PerceptronPredictor() {}
+
+    // The context keeps the +1/-1 window, for every perceptron of the run
+    virtual void attach(BranchContext &context)
+    {
+        history = &context.signedGlobalHistory(row_len);
+        own_history = SignedHistory(0);
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target)
+    {
+        lookup(ip);
+        return sum >= 0;
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        // Nothing changes between predict() and update() of the same branch
+        if (!lookup_valid || lookup_ip != ip)
+            lookup(ip);
+        lookup_valid = false;
+
+        if ((sum >= 0) != actual || (sum <= theta && sum >= -theta))
+        {
+            unsigned row = ip % num_rows;
+            int b = bias[row] + (actual ? 1 : -1);
+            if (b >= -127 && b <= 127)
+                bias[row] = b;
+            train(&weights[(size_t)row * row_len], history->newest(), actual);
+        }
+
+        if (history == &own_history)
+            own_history.push(actual);
+
+        updateCounters(predicted, actual);
+    }
+
+    virtual string getName()
+    {
+        std::ostringstream stream;
+        stream << "Perceptron-" << num_rows << "x" << hist_len;
+        return stream.str();
+    }
+
+    virtual bool saveState(PredictorStateWriter &out)
+    {
+        out.put(weights);
+        out.put(bias);
+        own_history.save(out);
+        return true;
+    }
+
+    virtual bool loadState(PredictorStateReader &in)
+    {
+        lookup_valid = false;
+        return in.get(weights) && in.get(bias) && own_history.load(in);
+    }
+
+    virtual string getParams()
+    {
+        return JsonObject("Perceptron").add("num_rows", num_rows).add("hist_len", hist_len).str();
+    }
+
+    // 8-bit weights and bias per row, plus the global history
+    virtual UINT64 getStorageBits() { return (UINT64)num_rows * (hist_len + 1) * 8 + hist_len; }
+
+private:
+    void lookup(ADDRINT ip)
+    {
+        unsigned row = ip % num_rows;
+        lookup_ip = ip;
+        lookup_valid = true;
+        sum = bias[row] + dot(&weights[(size_t)row * row_len], history->newest());
+    }
+
+    // sum(w[i] * x[i]) for x[i] in {-1, 1}. The padding weights are 0, so
+    // the vector loops can run over the whole row.
+    int dot(const int8_t *w, const int8_t *x) const
+    {
+        unsigned i = 0;
+        int result = 0;
+
+#if defined(__AVX2__)
+        const __m256i ones8 = _mm256_set1_epi8(1), ones16 = _mm256_set1_epi16(1);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i < row_len; i += 32)
+        {
+            __m256i wv = _mm256_loadu_si256((const __m256i *)(w + i));
+            __m256i xv = _mm256_loadu_si256((const __m256i *)(x + i));
+            __m256i p = _mm256_maddubs_epi16(ones8, _mm256_sign_epi8(wv, xv));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones16));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        result = _mm_cvtsi128_si32(s);
+#elif defined(__SSE4_1__)
+        const __m128i ones8 = _mm_set1_epi8(1), ones16 = _mm_set1_epi16(1);
+        __m128i acc = _mm_setzero_si128();
+        for (; i < row_len; i += 16)
+        {
+            __m128i wv = _mm_loadu_si128((const __m128i *)(w + i));
+            __m128i xv = _mm_loadu_si128((const __m128i *)(x + i));
+            __m128i p = _mm_maddubs_epi16(ones8, _mm_sign_epi8(wv, xv));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(p, ones16));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+        result = _mm_cvtsi128_si32(acc);
+#endif
+        for (; i < hist_len; i++)
+            result += w[i] * x[i];
+        return result;
+    }
+
+    // w[i] += taken ? x[i] : -x[i], saturating to [-127, 127]
+    void train(int8_t *w, const int8_t *x, bool taken) const
+    {
+        unsigned i = 0;
+
+#if defined(__AVX2__)
+        const __m256i dir = _mm256_set1_epi8(taken ? 1 : -1), min = _mm256_set1_epi8(-127);
+        for (; i < row_len; i += 32)
+        {
+            __m256i xv = _mm256_loadu_si256((const __m256i *)(x + i));
+            __m256i mv = _mm256_loadu_si256((const __m256i *)(&mask[i]));
+            __m256i delta = _mm256_and_si256(_mm256_sign_epi8(xv, dir), mv);
+            __m256i wv = _mm256_loadu_si256((const __m256i *)(w + i));
+            wv = _mm256_max_epi8(_mm256_adds_epi8(wv, delta), min);
+            _mm256_storeu_si256((__m256i *)(w + i), wv);
+        }
+#elif defined(__SSE4_1__)
+        const __m128i dir = _mm_set1_epi8(taken ? 1 : -1), min = _mm_set1_epi8(-127);
+        for (; i < row_len; i += 16)
+        {
+            __m128i xv = _mm_loadu_si128((const __m128i *)(x + i));
+            __m128i mv = _mm_loadu_si128((const __m128i *)(&mask[i]));
+            __m128i delta = _mm_and_si128(_mm_sign_epi8(xv, dir), mv);
+            __m128i wv = _mm_loadu_si128((const __m128i *)(w + i));
+            wv = _mm_max_epi8(_mm_adds_epi8(wv, delta), min);
+            _mm_storeu_si128((__m128i *)(w + i), wv);
+        }
+#endif
+        for (; i < hist_len; i++)
+        {
+            int v = w[i] + (taken ? x[i] : -x[i]);
+            w[i] = (v > 127) ? 127 : (v < -127) ? -127 : v;
+        }
+    }
+
+    const unsigned num_rows, hist_len, row_len;
+    const int theta;
+
+    std::vector<int8_t> weights; // num_rows rows of row_len weights
+    std::vector<int8_t> bias;
+    std::vector<int8_t> mask;    // -1 for the hist_len real weights of a row, 0 for the padding
+
+    SignedHistory own_history;     // global history, unless attach()ed to a context
+    const SignedHistory *history; // own_history or the context's
+
+    // Result of the last lookup()
+    ADDRINT lookup_ip;
+    bool lookup_valid;
+    int sum;
 };
 
 #endif
@@ -0,0 +1,144 @@
+#ifndef BRANCH_PROFILE_H
+#define BRANCH_PROFILE_H
+
+#include <ostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm> // std::partial_sort, std::fill
+
+/**
+ * Per static conditional branch accounting (cslab_branch -profile): the
+ * executions, the taken count and the mispredictions of every predictor.
+ *
+ * Branches are numbered when they are instrumented (id()), through an
+ * open-addressing hash map keyed by the IP, and the analysis call gets the
+ * number as an argument. At run time a branch costs no lookup, only
+ * increments in its own row of counters: executions, taken, then one
+ * miss count per predictor, contiguous.
+ **/
+class BranchProfile
+{
+public:
+    BranchProfile() : num_predictors(0), stride(2), keys(1024, 0), ids(1024, 0) {}
+
+    void init(size_t num_predictors_)
+    {
+        num_predictors = num_predictors_;
+        stride = 2 + num_predictors_;
+    }
+
+    // At instrumentation time. routine/offset: where the branch is, for the report.
+    UINT32 id(ADDRINT ip, const std::string &routine, ADDRINT offset)
+    {
+        size_t slot = find(ip);
+        if (keys[slot] == ip && ip != 0)
+            return ids[slot];
+
+        UINT32 id = branches.size();
+        branch_t b = {ip, routine, offset};
+        branches.push_back(b);
+        counters.resize(counters.size() + stride, 0);
+        keys[slot] = ip;
+        ids[slot] = id;
+
+        // At most half full, so that probes stay short
+        if (2 * branches.size() > keys.size())
+            grow();
+        return id;
+    }
+
+    // executions, taken, then the misses of every predictor
+    UINT64 *counts(UINT32 id) { return &counters[(size_t)id * stride]; }
+
+    void resetCounters() { std::fill(counters.begin(), counters.end(), 0); }
+
+    // The k branches with the most mispredictions of each predictor
+    void report(std::ostream &out, const std::vector<std::string> &names, size_t k)
+    {
+        std::vector<UINT32> order(branches.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        if (k > order.size())
+            k = order.size();
+
+        for (size_t p = 0; p < num_predictors; p++)
+        {
+            UINT64 total = 0;
+            for (size_t i = 0; i < branches.size(); i++)
+                total += counts(i)[2 + p];
+
+            std::partial_sort(order.begin(), order.begin() + k, order.end(), MoreMisses(*this, p));
+
+            out << "Top " << k << " branches of " << names[p] << ": "
+                << "(Address - Routine - Executions - Taken - Incorrect - MissRate - Share)\n";
+            for (size_t i = 0; i < k; i++)
+            {
+                const branch_t &b = branches[order[i]];
+                const UINT64 *c = counts(order[i]);
+                if (c[2 + p] == 0)
+                    break;
+                out << "  0x" << std::hex << b.ip << std::dec << " " << b.routine << "+0x"
+                    << std::hex << b.offset << std::dec << ": " << c[0] << " " << c[1] << " " << c[2 + p]
+                    << std::fixed << std::setprecision(2)
+                    << " " << 100.0 * c[2 + p] / c[0] << "%"
+                    << " " << 100.0 * c[2 + p] / total << "%\n";
+                out.unsetf(std::ios::fixed);
+            }
+            out << "\n";
+        }
+    }
+
+private:
+    struct branch_t
+    {
+        ADDRINT ip;
+        std::string routine;
+        ADDRINT offset;
+    };
+
+    struct MoreMisses
+    {
+        MoreMisses(BranchProfile &profile_, size_t p_) : profile(profile_), p(p_) {}
+        bool operator()(UINT32 a, UINT32 b) const
+        {
+            return profile.counts(a)[2 + p] > profile.counts(b)[2 + p];
+        }
+        BranchProfile &profile;
+        size_t p;
+    };
+
+    // The slot of ip, or the empty slot where it goes. 0 marks empty slots.
+    size_t find(ADDRINT ip) const
+    {
+        size_t mask = keys.size() - 1;
+        size_t slot = (size_t)((ip * 0x9e3779b97f4a7c15ULL) >> 20) & mask;
+        while (keys[slot] != 0 && keys[slot] != ip)
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void grow()
+    {
+        std::vector<ADDRINT> old_keys(keys.size() * 2, 0);
+        std::vector<UINT32> old_ids(ids.size() * 2, 0);
+        old_keys.swap(keys);
+        old_ids.swap(ids);
+        for (size_t i = 0; i < old_keys.size(); i++)
+        {
+            if (old_keys[i] == 0)
+                continue;
+            size_t slot = find(old_keys[i]);
+            keys[slot] = old_keys[i];
+            ids[slot] = old_ids[i];
+        }
+    }
+
+    size_t num_predictors, stride;
+    std::vector<ADDRINT> keys; // power of 2 slots
+    std::vector<UINT32> ids;
+    std::vector<branch_t> branches;
+    std::vector<UINT64> counters; // stride per branch
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef BRANCH_RING_H
+#define BRANCH_RING_H
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <vector>
+
+/**
+ * Lock-free single-producer / single-consumer ring buffer.
+ * The producer only writes head, the consumer only writes tail, and each
+ * lives in its own cache line so the two threads do not false-share.
+ * The consumer works on contiguous spans in place (peek()/consume()), so a
+ * whole batch of records is handed to the predictors without copying.
+ **/
+template <typename T>
+class SpscRing
+{
+public:
+    // capacity must be a power of 2
+    SpscRing(size_t capacity) : items(capacity), mask(capacity - 1), head(0), tail(0) {}
+
+    // Producer: push up to n items, returns how many fit.
+    size_t push(const T *src, size_t n)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t free_slots = items.size() - (h - tail.load(std::memory_order_acquire));
+        if (n > free_slots)
+            n = free_slots;
+        for (size_t i = 0; i < n; i++)
+            items[(h + i) & mask] = src[i];
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: contiguous span of available items, without removing them.
+    size_t peek(const T *&first)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        size_t until_wrap = items.size() - (t & mask);
+        first = &items[t & mask];
+        return (avail < until_wrap) ? avail : until_wrap;
+    }
+
+    // Consumer: release n items returned by peek().
+    void consume(size_t n)
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    bool empty()
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> items;
+    const size_t mask;
+
+    // Explicit padding rather than alignas, which needs C++17 aligned new
+    // for heap allocated rings.
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef BRANCH_TRACE_H
+#define BRANCH_TRACE_H
+
+#include <cstdint> // uint64_t
+#include <cstdio>  // FILE, fopen(), fread(), fwrite()
+#include <cstring> // memcpy(), memcmp()
+#include <string>
+#include <vector>
+
+/**
+ * Compact binary branch trace, written by cslab_branch (-trace) and read back
+ * by cslab_replay. Pin independent, so that it can be used by both.
+ *
+ * File layout:
+ *   8-byte header: "CSLBTR" + 2-byte format version
+ *   blocks of:     [uint32 num_records][uint32 payload_bytes][payload]
+ *
+ * Each record in the payload is:
+ *   1 byte         flags (which analysis routines the instruction triggers)
+ *   varint         instructions executed since the previous record
+ *   zigzag varint  ip - previous ip (previous ip is 0 at block start)
+ *   zigzag varint  target - ip
+ *   1 byte         instruction size (calls only, for the RAS return address)
+ *
+ * Deltas restart at every block, so blocks can be decoded independently.
+ * The last record of a trace has flags == 0 (BR_END) and only carries the
+ * instruction count after the last branch.
+ *
+ * A write that fails (e.g. a full disk) makes close() return false. A block
+ * that ends inside a record makes next() return false and isCorrupt() true.
+ **/
+
+enum BranchRecordFlags
+{
+    BR_END = 0,
+    BR_COND = 1 << 0,  // conditional branch   -> branch_predictors
+    BR_CALL = 1 << 1,  // call                 -> ras_vec push
+    BR_RET = 1 << 2,   // return               -> ras_vec pop
+    BR_BTB = 1 << 3,   // any branch but ret   -> btb_predictors
+    BR_TAKEN = 1 << 7, // branch outcome
+};
+
+struct BranchRecord
+{
+    uint64_t ip;
+    uint64_t target;
+    uint64_t icount_delta;
+    uint32_t size;
+    uint8_t flags;
+};
+
+static const char BRANCH_TRACE_MAGIC[6] = {'C', 'S', 'L', 'B', 'T', 'R'};
+static const uint16_t BRANCH_TRACE_VERSION = 1;
+static const uint32_t BRANCH_TRACE_BLOCK_RECORDS = 1 << 16;
+// flags + 3 varints of at most 10 bytes + instruction size
+static const uint32_t BRANCH_TRACE_MAX_RECORD_BYTES = 32;
+
+class BranchTraceWriter
+{
+public:
+    BranchTraceWriter() : fp(NULL), num_records(0), prev_ip(0), total_records(0), write_error(false)
+    {
+        payload.resize(BRANCH_TRACE_BLOCK_RECORDS * BRANCH_TRACE_MAX_RECORD_BYTES);
+        pos = 0;
+    }
+    ~BranchTraceWriter() { close(0); }
+
+    bool open(const std::string &filename)
+    {
+        fp = fopen(filename.c_str(), "wb");
+        if (!fp)
+            return false;
+        if (fwrite(BRANCH_TRACE_MAGIC, 1, sizeof(BRANCH_TRACE_MAGIC), fp) != sizeof(BRANCH_TRACE_MAGIC) ||
+            fwrite(&BRANCH_TRACE_VERSION, sizeof(BRANCH_TRACE_VERSION), 1, fp) != 1)
+        {
+            fclose(fp);
+            fp = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    bool isOpen() { return fp != NULL; }
+
+    void append(uint8_t flags, uint64_t icount_delta, uint64_t ip, uint64_t target, uint32_t size)
+    {
+        uint8_t *out = &payload[pos];
+        uint8_t *start = out;
+
+        *out++ = flags;
+        out = putVarint(out, icount_delta);
+        out = putVarint(out, zigzag(ip - prev_ip));
+        out = putVarint(out, zigzag(target - ip));
+        if (flags & BR_CALL)
+            *out++ = (uint8_t)size;
+
+        pos += out - start;
+        prev_ip = ip;
+        total_records++;
+        if (++num_records == BRANCH_TRACE_BLOCK_RECORDS)
+            flushBlock();
+    }
+
+    // Write the end record with the instructions executed after the last
+    // branch and close the file. False if any write of the trace failed.
+    bool close(uint64_t trailing_icount)
+    {
+        if (!fp)
+            return !write_error;
+        append(BR_END, trailing_icount, prev_ip, prev_ip, 0);
+        flushBlock();
+        if (fclose(fp) != 0)
+            write_error = true;
+        fp = NULL;
+        return !write_error;
+    }
+
+    uint64_t getNumRecords() { return total_records; }
+
+private:
+    static uint64_t zigzag(uint64_t v) { return (v << 1) ^ (uint64_t)((int64_t)v >> 63); }
+
+    static uint8_t *putVarint(uint8_t *out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            *out++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (uint8_t)v;
+        return out;
+    }
+
+    void flushBlock()
+    {
+        if (num_records == 0)
+            return;
+        uint32_t header[2] = {num_records, (uint32_t)pos};
+        if (fwrite(header, sizeof(header), 1, fp) != 1 || fwrite(&payload[0], 1, pos, fp) != pos)
+            write_error = true;
+        num_records = 0;
+        pos = 0;
+        prev_ip = 0;
+    }
+
+    FILE *fp;
+    std::vector<uint8_t> payload;
+    size_t pos;
+    uint32_t num_records;
+    uint64_t prev_ip;
+    uint64_t total_records;
+    bool write_error;
+};
+
+//> Where a block starts, for the readers of a parallel replay.
+struct BranchTraceBlock
+{
+    int64_t offset;
+    uint32_t num_records;
+};
+
+class BranchTraceReader
+{
+public:
+    BranchTraceReader() : fp(NULL), pos(0), remaining(0), prev_ip(0), corrupt(false) {}
+    ~BranchTraceReader()
+    {
+        if (fp)
+            fclose(fp);
+    }
+
+    bool open(const std::string &filename)
+    {
+        char magic[sizeof(BRANCH_TRACE_MAGIC)];
+        uint16_t version;
+
+        fp = fopen(filename.c_str(), "rb");
+        if (!fp)
+            return false;
+        if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+            memcmp(magic, BRANCH_TRACE_MAGIC, sizeof(magic)) != 0 ||
+            fread(&version, sizeof(version), 1, fp) != 1 ||
+            version != BRANCH_TRACE_VERSION)
+        {
+            fclose(fp);
+            fp = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    // Decode the next record. Returns false at the end of the trace (the
+    // BR_END record is returned like any other record) or of a corrupt block.
+    bool next(BranchRecord &rec)
+    {
+        if (remaining == 0 && !readBlock())
+            return false;
+
+        const uint8_t *start = payload.data() + pos;
+        const uint8_t *end = payload.data() + payload.size();
+        const uint8_t *in = start;
+        uint64_t ip_delta, target_delta;
+
+        if (in == end)
+            return fail();
+        rec.flags = *in++;
+        in = getVarint(in, end, rec.icount_delta);
+        in = getVarint(in, end, ip_delta);
+        in = getVarint(in, end, target_delta);
+        if (!in || ((rec.flags & BR_CALL) && in == end))
+            return fail();
+        rec.ip = prev_ip + unzigzag(ip_delta);
+        rec.target = rec.ip + unzigzag(target_delta);
+        rec.size = (rec.flags & BR_CALL) ? *in++ : 0;
+
+        pos += in - start;
+        prev_ip = rec.ip;
+        remaining--;
+        return true;
+    }
+
+    // Offsets and record counts of every block, from the block headers only.
+    // Call it before the first next().
+    bool scanBlocks(std::vector<BranchTraceBlock> &blocks)
+    {
+        uint32_t header[2];
+        int64_t offset = ftello(fp);
+        while (fread(header, sizeof(header), 1, fp) == 1)
+        {
+            BranchTraceBlock block = {offset, header[0]};
+            blocks.push_back(block);
+            offset += sizeof(header) + header[1];
+            if (fseeko(fp, offset, SEEK_SET) != 0)
+                return false;
+        }
+        return fseeko(fp, sizeof(BRANCH_TRACE_MAGIC) + sizeof(BRANCH_TRACE_VERSION), SEEK_SET) == 0;
+    }
+
+    // Continue with the first record of a block returned by scanBlocks()
+    bool seek(const BranchTraceBlock &block)
+    {
+        remaining = 0;
+        return fseeko(fp, block.offset, SEEK_SET) == 0;
+    }
+
+    // The last next() stopped at a truncated or corrupt block
+    bool isCorrupt() const { return corrupt; }
+
+private:
+    static uint64_t unzigzag(uint64_t v) { return (v >> 1) ^ (~(v & 1) + 1); }
+
+    // NULL if the varint runs past end or over 10 bytes (or in is NULL)
+    static const uint8_t *getVarint(const uint8_t *in, const uint8_t *end, uint64_t &v)
+    {
+        unsigned shift = 0;
+        v = 0;
+        if (!in)
+            return NULL;
+        while (in != end && shift < 64)
+        {
+            v |= (uint64_t)(*in & 0x7f) << shift;
+            if (!(*in++ & 0x80))
+                return in;
+            shift += 7;
+        }
+        return NULL;
+    }
+
+    bool fail()
+    {
+        corrupt = true;
+        remaining = 0;
+        return false;
+    }
+
+    bool readBlock()
+    {
+        uint32_t header[2];
+        if (!fp || fread(header, sizeof(header), 1, fp) != 1)
+            return false;
+        payload.resize(header[1]);
+        if (fread(payload.data(), 1, header[1], fp) != header[1])
+            return fail();
+        remaining = header[0];
+        pos = 0;
+        prev_ip = 0;
+        return remaining > 0;
+    }
+
+    FILE *fp;
+    std::vector<uint8_t> payload;
+    size_t pos;
+    uint32_t remaining;
+    uint64_t prev_ip;
+    bool corrupt;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#include "packed_counters.h"
+
+using namespace std;
+
+/**
+ * Microbenchmark for packed_counters.h: 16 tables of 2-bit saturating
+ * counters (one per simulated predictor) are updated for every branch of a
+ * synthetic branch stream, once with an unsigned long long per counter (the
+ * old NbitPredictor / TournamentHybridPredictor tables), once with
+ * CounterArray (a byte per counter, the default CounterTable of the
+ * predictors) and once with
+ * PackedCounterArray.
+ *
+ * Usage: counter_bench [branches (default 20M)]
+ **/
+
+static const unsigned NUM_TABLES = 16;
+static const unsigned CNTR_BITS = 2;
+static const unsigned COUNTER_MAX = (1 << CNTR_BITS) - 1;
+
+// Table indices with the reuse of a real run: 3/4 of the lookups hit a hot
+// set of 4K entries (PC-indexed tables), the rest are spread over the whole
+// table (history-indexed tables).
+static vector<uint32_t> make_stream(size_t n, uint32_t entries)
+{
+    vector<uint32_t> stream(n);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < n; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint32_t r = (uint32_t)x;
+        stream[i] = ((r & 3) ? (r >> 2) % 4096 : (r >> 2)) & (entries - 1);
+    }
+    return stream;
+}
+
+template <typename T>
+static double bench_plain(const vector<uint32_t> &stream, uint32_t entries, uint64_t &checksum)
+{
+    vector<vector<T>> tables(NUM_TABLES, vector<T>(entries, 0));
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        uint32_t idx = stream[i];
+        bool taken = (idx ^ i) & 1;
+        for (unsigned t = 0; t < NUM_TABLES; t++)
+        {
+            T &c = tables[t][(idx + t * 977) & (entries - 1)];
+            checksum += c >> (CNTR_BITS - 1);
+            if (taken)
+            {
+                if (c < COUNTER_MAX)
+                    c++;
+            }
+            else if (c > 0)
+                c--;
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+template <typename Table>
+static double bench_table(const vector<uint32_t> &stream, uint32_t entries, const Table &empty, uint64_t &checksum)
+{
+    vector<Table> tables(NUM_TABLES, empty);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        uint32_t idx = stream[i];
+        bool taken = (idx ^ i) & 1;
+        for (unsigned t = 0; t < NUM_TABLES; t++)
+        {
+            Table &table = tables[t];
+            uint32_t j = (idx + t * 977) & (entries - 1);
+            checksum += table.get(j) >> (CNTR_BITS - 1);
+            table.update(j, taken, COUNTER_MAX);
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t branches = (argc > 1) ? strtoull(argv[1], NULL, 10) : 20000000;
+    uint32_t sizes[] = {1 << 13, 1 << 15, 1 << 17, 1 << 20};
+
+    cout << NUM_TABLES << " tables of " << CNTR_BITS << "-bit counters, "
+         << branches << " branches\n\n";
+    cout << setw(10) << "entries" << setw(14) << "layout" << setw(14) << "footprint"
+         << setw(14) << "Mbranch/s" << "\n";
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint32_t entries = sizes[s];
+        vector<uint32_t> stream = make_stream(branches, entries);
+        uint64_t sums[3] = {0, 0, 0};
+        double t[3];
+        size_t footprint[3] = {
+            NUM_TABLES * entries * sizeof(unsigned long long),
+            NUM_TABLES * CounterArray(entries, CNTR_BITS).sizeBytes(),
+            NUM_TABLES * PackedCounterArray(entries, CNTR_BITS).sizeBytes(),
+        };
+        const char *names[3] = {"ull", "bytes", "packed"};
+
+        t[0] = bench_plain<unsigned long long>(stream, entries, sums[0]);
+        t[1] = bench_table(stream, entries, CounterArray(entries, CNTR_BITS), sums[1]);
+        t[2] = bench_table(stream, entries, PackedCounterArray(entries, CNTR_BITS), sums[2]);
+
+        for (int i = 0; i < 3; i++)
+            cout << setw(10) << entries << setw(14) << names[i]
+                 << setw(12) << footprint[i] / 1024 << "KB"
+                 << setw(14) << fixed << setprecision(1) << branches / t[i] / 1e6 << "\n";
+        if (sums[0] != sums[1] || sums[0] != sums[2])
+        {
+            cerr << "Error: layouts disagree on the predictions" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,476 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <csignal>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/**
+ * Runs a Pin tool over every benchmark of a SPEC inputs directory, in place
+ * of the run_*_predictors.sh / run_*_stats.sh scripts that start all the
+ * benchmarks at once:
+ *
+ *   - every <inputs>/<benchmark>/speccmds.cmd gives one job, its first
+ *     command (-all_inputs: one job per command), run in the benchmark
+ *     directory as pin -t <tool> -o <out>/<benchmark>.<name>.out <knobs> -- <command>
+ *   - at most -j jobs at a time (default: the number of CPUs) and, with
+ *     -mem, only as many as fit in the available memory
+ *   - longest job first, by the time of the previous run of the same job,
+ *     so that the long ref benchmarks do not start last; jobs never run
+ *     before go first
+ *   - the wall, user and system time and the peak memory of every job are
+ *     appended to the state file (default <out>/<name>.state); an
+ *     interrupted or partly failed batch continues where it stopped when
+ *     run again, done jobs whose output exists are skipped
+ *   - failed jobs are retried -retries times
+ *
+ * Usage: cslab_batch -pin <pin> -t <tool.so> -inputs <dir> -o <outdir> -name <name>
+ *                    [-knobs "<knobs>"] [-j <jobs>] [-mem <MB>] [-retries <n>]
+ *                    [-state <file>] [-all_inputs] [-n] [<benchmark> ...]
+ **/
+
+//> One Pin run: a command of a speccmds.cmd file.
+struct job_t
+{
+    string name;                       // benchmark, plus .<k> for the k-th command
+    string dir;                        // where the command runs
+    string command;                    // from the first "./"
+    string stdin_file, stdout_file, stderr_file;
+    string out_file;                   // of the tool
+    double estimate;                   // seconds, < 0 if never run
+    uint64_t mem_kb;                   // peak memory of the last run, or -mem
+    unsigned attempts;
+    pid_t pid;
+    struct timeval start;
+};
+
+//> Last state file record of a job.
+struct record_t
+{
+    bool done;
+    double wall, user, sys;
+    uint64_t max_rss_kb;
+};
+
+volatile sig_atomic_t interrupted = 0;
+
+int Usage()
+{
+    cerr << "This tool runs a pintool over the SPEC benchmarks of an inputs directory.\n\n";
+    cerr << "  -pin <file>      pin executable (default $PIN_ROOT/pin)\n";
+    cerr << "  -t <file>        pintool, e.g. obj-intel64/cslab_branch.so\n";
+    cerr << "  -inputs <dir>    one directory per benchmark, with a speccmds.cmd\n";
+    cerr << "  -o <dir>         output directory of the tool\n";
+    cerr << "  -name <name>     outputs are <dir>/<benchmark>.<name>.out\n";
+    cerr << "  -knobs <knobs>   tool knobs, one argument\n";
+    cerr << "  -j <n>           jobs at a time (default: number of CPUs)\n";
+    cerr << "  -mem <MB>        memory of a job that never ran; limits the jobs to the available memory\n";
+    cerr << "  -retries <n>     reruns of a failed job (default 1)\n";
+    cerr << "  -state <file>    timings and completed jobs (default <dir>/<name>.state)\n";
+    cerr << "  -all_inputs      a job per speccmds.cmd command, not just the first\n";
+    cerr << "  -n               only print the jobs, in the order they would start\n";
+    cerr << "  <benchmark> ...  only these benchmarks\n";
+    cerr << endl;
+    return -1;
+}
+
+//> SIGINT/SIGTERM: no new jobs, the running ones are stopped.
+void on_signal(int) { interrupted = 1; }
+
+string absolutePath(const string &path)
+{
+    if (path.empty() || path[0] == '/')
+        return path;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return path;
+    return string(cwd) + "/" + path;
+}
+
+bool isFile(const string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+//> The jobs of one benchmark. A speccmds.cmd line is
+//  "[-C <dir>] [-i <stdin>] [-o <stdout>] [-e <stderr>] ... ./<exe> <args>";
+//  lines without a "./" command (specinvoke settings) are skipped.
+void readSpecCmds(const string &bench_dir, const string &bench, bool all_inputs, vector<job_t> &jobs)
+{
+    ifstream in((bench_dir + "/speccmds.cmd").c_str());
+    string line;
+    unsigned k = 0;
+    while (getline(in, line))
+    {
+        size_t cmd = line.find("./");
+        if (cmd == string::npos)
+            continue;
+
+        job_t job;
+        job.name = bench;
+        job.dir = bench_dir;
+        job.command = line.substr(cmd);
+        job.stdout_file = "stdout.log";
+        job.stderr_file = "stderr.log";
+        if (k > 0)
+        {
+            ostringstream suffix;
+            suffix << "." << k;
+            job.name += suffix.str();
+            job.stdout_file = "stdout" + suffix.str() + ".log";
+            job.stderr_file = "stderr" + suffix.str() + ".log";
+        }
+
+        istringstream options(line.substr(0, cmd));
+        string option, value;
+        while (options >> option)
+        {
+            if (option[0] != '-' || !(options >> value))
+                continue;
+            if (option == "-C")
+                job.dir = (value[0] == '/') ? value : bench_dir + "/" + value;
+            else if (option == "-i")
+                job.stdin_file = value;
+            else if (option == "-o")
+                job.stdout_file = value;
+            else if (option == "-e")
+                job.stderr_file = value;
+        }
+
+        job.estimate = -1;
+        job.mem_kb = 0;
+        job.attempts = 0;
+        job.pid = 0;
+        jobs.push_back(job);
+        k++;
+        if (!all_inputs)
+            break;
+    }
+}
+
+//> The state file: one line per finished run, the last one of a job counts.
+//  "<job> done|failed <wall s> <user s> <sys s> <max RSS KB>"
+map<string, record_t> readState(const string &filename)
+{
+    map<string, record_t> records;
+    ifstream in(filename.c_str());
+    string name, status;
+    record_t r;
+    while (in >> name >> status >> r.wall >> r.user >> r.sys >> r.max_rss_kb)
+    {
+        r.done = (status == "done");
+        records[name] = r;
+    }
+    return records;
+}
+
+//> MemAvailable of /proc/meminfo, 0 if unknown.
+uint64_t availableMemoryKb()
+{
+    ifstream in("/proc/meminfo");
+    string line, key;
+    uint64_t value;
+    while (getline(in, line))
+    {
+        istringstream fields(line);
+        if (fields >> key >> value && key == "MemAvailable:")
+            return value;
+    }
+    return 0;
+}
+
+string describeStatus(int status)
+{
+    ostringstream stream;
+    if (WIFSIGNALED(status))
+        stream << "signal " << WTERMSIG(status);
+    else if (WEXITSTATUS(status) != 0)
+        stream << "exit status " << WEXITSTATUS(status);
+    else
+        stream << "no tool output";
+    return stream.str();
+}
+
+//> Longest first; jobs without a previous time first of all, by name.
+bool longerFirst(const job_t &a, const job_t &b)
+{
+    if ((a.estimate < 0) != (b.estimate < 0))
+        return a.estimate < 0;
+    if (a.estimate != b.estimate)
+        return a.estimate > b.estimate;
+    return a.name < b.name;
+}
+
+//> Starts a job in its own process group, so that an interrupt can stop
+//  Pin and the benchmark together.
+bool startJob(job_t &job, const string &pin_cmd)
+{
+    string command = "exec " + pin_cmd + " -o " + job.out_file + " -- " + job.command;
+    gettimeofday(&job.start, NULL);
+    job.attempts++;
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        if (chdir(job.dir.c_str()) != 0)
+            _exit(126);
+
+        int in = open(job.stdin_file.empty() ? "/dev/null" : job.stdin_file.c_str(), O_RDONLY);
+        int out = open(job.stdout_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open(job.stderr_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0 || err < 0)
+            _exit(126);
+        dup2(in, 0);
+        dup2(out, 1);
+        dup2(err, 2);
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    job.pid = pid;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    string pin = getenv("PIN_ROOT") ? string(getenv("PIN_ROOT")) + "/pin" : "";
+    string tool, inputs, out_dir, name, knobs, state_file;
+    long num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t default_mem_kb = 0;
+    unsigned retries = 1;
+    bool all_inputs = false, dry_run = false;
+    vector<string> only;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-pin") && i + 1 < argc)
+            pin = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            tool = argv[++i];
+        else if (!strcmp(argv[i], "-inputs") && i + 1 < argc)
+            inputs = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (!strcmp(argv[i], "-name") && i + 1 < argc)
+            name = argv[++i];
+        else if (!strcmp(argv[i], "-knobs") && i + 1 < argc)
+            knobs = argv[++i];
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            num_jobs = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-mem") && i + 1 < argc)
+            default_mem_kb = strtoull(argv[++i], NULL, 10) * 1024;
+        else if (!strcmp(argv[i], "-retries") && i + 1 < argc)
+            retries = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-state") && i + 1 < argc)
+            state_file = argv[++i];
+        else if (!strcmp(argv[i], "-all_inputs"))
+            all_inputs = true;
+        else if (!strcmp(argv[i], "-n"))
+            dry_run = true;
+        else if (argv[i][0] != '-')
+            only.push_back(argv[i]);
+        else
+            return Usage();
+    }
+    if (pin.empty() || tool.empty() || inputs.empty() || out_dir.empty() || name.empty() || num_jobs < 1)
+        return Usage();
+
+    // The jobs change directory
+    pin = absolutePath(pin);
+    tool = absolutePath(tool);
+    inputs = absolutePath(inputs);
+    out_dir = absolutePath(out_dir);
+    if (state_file.empty())
+        state_file = out_dir + "/" + name + ".state";
+    mkdir(out_dir.c_str(), 0755);
+
+    // One directory per benchmark
+    vector<string> benchmarks;
+    DIR *dir = opendir(inputs.c_str());
+    if (!dir)
+    {
+        cerr << "Error: could not open inputs directory " << inputs << endl;
+        return 1;
+    }
+    while (struct dirent *entry = readdir(dir))
+    {
+        string bench = entry->d_name;
+        if (bench[0] != '.' && isFile(inputs + "/" + bench + "/speccmds.cmd") &&
+            (only.empty() || find(only.begin(), only.end(), bench) != only.end()))
+            benchmarks.push_back(bench);
+    }
+    closedir(dir);
+    sort(benchmarks.begin(), benchmarks.end());
+
+    vector<job_t> jobs;
+    for (size_t b = 0; b < benchmarks.size(); b++)
+        readSpecCmds(inputs + "/" + benchmarks[b], benchmarks[b], all_inputs, jobs);
+
+    // Skip what is done, order the rest by the previous times
+    map<string, record_t> records = readState(state_file);
+    vector<job_t> pending;
+    size_t skipped = 0;
+    for (size_t j = 0; j < jobs.size(); j++)
+    {
+        job_t &job = jobs[j];
+        job.out_file = out_dir + "/" + job.name + "." + name + ".out";
+        job.mem_kb = default_mem_kb;
+        map<string, record_t>::const_iterator r = records.find(job.name);
+        if (r != records.end())
+        {
+            if (r->second.done && isFile(job.out_file))
+            {
+                skipped++;
+                continue;
+            }
+            if (r->second.done)
+                job.estimate = r->second.wall;
+            if (r->second.max_rss_kb > 0)
+                job.mem_kb = r->second.max_rss_kb;
+        }
+        pending.push_back(job);
+    }
+    stable_sort(pending.begin(), pending.end(), longerFirst);
+
+    string pin_cmd = pin + " -t " + tool + (knobs.empty() ? "" : " " + knobs);
+    cout << jobs.size() << " jobs, " << skipped << " done already, " << pending.size() << " to run, "
+         << num_jobs << " at a time\n";
+    if (dry_run)
+    {
+        for (size_t j = 0; j < pending.size(); j++)
+        {
+            cout << pending[j].name << " (";
+            if (pending[j].estimate < 0)
+                cout << "no previous time";
+            else
+                cout << pending[j].estimate << " s";
+            cout << "): cd " << pending[j].dir << " && " << pin_cmd << " -o " << pending[j].out_file
+                 << " -- " << pending[j].command << "\n";
+        }
+        return 0;
+    }
+
+    // -mem: 90% of the memory available now, shared by the running jobs
+    uint64_t mem_budget_kb = 0;
+    if (default_mem_kb > 0)
+        mem_budget_kb = availableMemoryKb() / 10 * 9;
+
+    ofstream state(state_file.c_str(), ios::app);
+    if (!state)
+    {
+        cerr << "Error: could not open state file " << state_file << endl;
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal; // no SA_RESTART, so that wait4() returns
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    vector<job_t> running;
+    uint64_t running_mem_kb = 0;
+    size_t finished = 0, failed = 0, total = pending.size();
+    struct timeval batch_start;
+    gettimeofday(&batch_start, NULL);
+
+    while (!interrupted && (!pending.empty() || !running.empty()))
+    {
+        // The longest job that fits; a job that fits nowhere runs alone
+        for (size_t j = 0; j < pending.size() && (long)running.size() < num_jobs;)
+        {
+            job_t &job = pending[j];
+            if (mem_budget_kb && !running.empty() && running_mem_kb + job.mem_kb > mem_budget_kb)
+            {
+                j++;
+                continue;
+            }
+            if (!startJob(job, pin_cmd))
+            {
+                cerr << "Error: could not start " << job.name << ": " << strerror(errno) << endl;
+                return 1;
+            }
+            running_mem_kb += job.mem_kb;
+            running.push_back(job);
+            pending.erase(pending.begin() + j);
+        }
+
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid < 0)
+            continue; // EINTR
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        size_t r = 0;
+        while (r < running.size() && running[r].pid != pid)
+            r++;
+        if (r == running.size())
+            continue;
+        job_t job = running[r];
+        running.erase(running.begin() + r);
+        running_mem_kb -= job.mem_kb;
+
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && isFile(job.out_file);
+        double wall = (now.tv_sec - job.start.tv_sec) + (now.tv_usec - job.start.tv_usec) / 1e6;
+        double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+        double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        state << job.name << (ok ? " done " : " failed ") << wall << " " << user << " " << sys << " "
+              << usage.ru_maxrss << endl;
+
+        if (!ok && job.attempts <= retries && !interrupted)
+        {
+            cout << job.name << " failed (" << describeStatus(status) << "), retrying\n";
+            pending.insert(pending.begin(), job);
+            continue;
+        }
+        finished++;
+        failed += !ok;
+        cout << "[" << finished << "/" << total << "] " << job.name << (ok ? "" : " FAILED, " + describeStatus(status)) << ": "
+             << wall << " s, user " << user << " s, sys " << sys << " s, max RSS "
+             << usage.ru_maxrss / 1024 << " MB" << endl;
+    }
+
+    if (interrupted)
+    {
+        // Stop the running jobs; they start again on the next run
+        for (size_t r = 0; r < running.size(); r++)
+            kill(-running[r].pid, SIGTERM);
+        for (size_t r = 0; r < running.size(); r++)
+            waitpid(running[r].pid, NULL, 0);
+        cerr << "Interrupted, " << pending.size() + running.size()
+             << " jobs left. Run the same command again to continue." << endl;
+        return 130;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    cout << "All jobs done in " << (now.tv_sec - batch_start.tv_sec) << " s";
+    if (failed)
+        cout << ", " << failed << " failed (see their stderr logs)";
+    cout << endl;
+    return failed ? 1 : 0;
+}
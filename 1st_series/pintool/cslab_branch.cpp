@@ -3,18 +3,85 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstddef> // offsetof
+#include <cstring> // memset()
 
 using namespace std;
 
 #include "branch_predictor.h"
 #include "pentium_m_predictor/pentium_m_branch_predictor.h"
 #include "ras.h"
+#include "branch_trace.h"
+#include "branch_ring.h"
+#include "predictor_sweep.h"
+#include "predictor_config.h"
+#include "simpoint.h"
+#include "interval_series.h"
+#include "branch_profile.h"
+#include "results_output.h"
+#ifdef CSLAB_STATIC_PREDICTORS
+#include "static_predictors.h"
+#endif
 
 /* ===================================================================== */
 /* Commandline Switches                                                  */
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
                             "o", "cslab_branch.out", "specify output file name");
+KNOB<string> KnobConfigFile(KNOB_MODE_WRITEONCE, "pintool",
+                            "config", "", "predictor configuration file (default: InitPredictors())");
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool",
+                           "trace", "", "record a branch trace (replay it with cslab_replay)");
+KNOB<BOOL> KnobTraceOnly(KNOB_MODE_WRITEONCE, "pintool",
+                         "trace_only", "0", "only record the trace, do not simulate predictors");
+KNOB<BOOL> KnobBuffered(KNOB_MODE_WRITEONCE, "pintool",
+                        "buffered", "0", "buffer branches per thread and simulate them in batches");
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+                             "buffer_pages", "256", "size of the per-thread branch buffer in pages");
+KNOB<UINT32> KnobWorkers(KNOB_MODE_WRITEONCE, "pintool",
+                         "workers", "0", "simulate the predictors on this many Pin internal threads");
+KNOB<UINT32> KnobRingEntries(KNOB_MODE_WRITEONCE, "pintool",
+                             "ring_entries", "65536", "branch records per worker ring (power of 2)");
+KNOB<BOOL> KnobStats(KNOB_MODE_WRITEONCE, "pintool",
+                     "stats", "0", "also gather the branch statistics of cslab_branch_stats");
+KNOB<UINT64> KnobSkip(KNOB_MODE_WRITEONCE, "pintool",
+                      "skip", "0", "warm-up: train the predictors on the first N instructions without counting them");
+KNOB<UINT64> KnobMaxInstructions(KNOB_MODE_WRITEONCE, "pintool",
+                                 "max", "0", "detach after this many counted instructions (0: run to the end)");
+KNOB<string> KnobRoiBegin(KNOB_MODE_WRITEONCE, "pintool",
+                          "roi_begin", "", "simulate only after calls to this function (e.g. __parsec_roi_begin)");
+KNOB<string> KnobRoiEnd(KNOB_MODE_WRITEONCE, "pintool",
+                        "roi_end", "", "stop simulating at calls to this function (e.g. __parsec_roi_end)");
+KNOB<string> KnobBbvFile(KNOB_MODE_WRITEONCE, "pintool",
+                         "bbv", "", "only profile basic-block vectors for cslab_simpoint, no predictors");
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+                          "interval", "100000000", "instructions per -bbv/-simpoints interval");
+KNOB<string> KnobSimPoints(KNOB_MODE_WRITEONCE, "pintool",
+                           "simpoints", "", "simulate only these intervals (.simpoints file of cslab_simpoint)");
+KNOB<string> KnobWeights(KNOB_MODE_WRITEONCE, "pintool",
+                         "weights", "", "weights of the -simpoints intervals (.weights file)");
+KNOB<UINT64> KnobWarmup(KNOB_MODE_WRITEONCE, "pintool",
+                        "warmup", "10000000", "instructions simulated before each -simpoints interval");
+KNOB<string> KnobSeriesFile(KNOB_MODE_WRITEONCE, "pintool",
+                            "series", "", "write the mispredictions of every predictor every -series_interval instructions");
+KNOB<UINT64> KnobSeriesInterval(KNOB_MODE_WRITEONCE, "pintool",
+                                "series_interval", "10000000", "instructions between two -series rows");
+KNOB<BOOL> KnobSeriesBinary(KNOB_MODE_WRITEONCE, "pintool",
+                            "series_binary", "0", "write the -series file in binary instead of CSV");
+KNOB<string> KnobProfileFile(KNOB_MODE_WRITEONCE, "pintool",
+                             "profile", "", "write the branches with the most mispredictions of every predictor");
+KNOB<UINT32> KnobProfileTop(KNOB_MODE_WRITEONCE, "pintool",
+                            "profile_top", "20", "number of branches per predictor in the -profile report");
+KNOB<string> KnobThreads(KNOB_MODE_WRITEONCE, "pintool",
+                         "threads", "", "multithreaded programs: private (predictors per thread) or shared (shared tables, per-thread histories)");
+KNOB<string> KnobSaveState(KNOB_MODE_WRITEONCE, "pintool",
+                           "save_state", "", "write the predictor tables at the end (with -simpoints: at the start of every interval, to <file>.<interval>)");
+KNOB<string> KnobLoadState(KNOB_MODE_WRITEONCE, "pintool",
+                           "load_state", "", "start from saved predictor tables (with -simpoints: every interval from <file>.<interval>, no warm-up)");
+KNOB<string> KnobJsonFile(KNOB_MODE_WRITEONCE, "pintool",
+                          "json", "", "also write the results as JSON lines (schema in results_output.h)");
+KNOB<string> KnobRecordsFile(KNOB_MODE_WRITEONCE, "pintool",
+                             "records", "", "also write the results as binary records (results_output.h)");
 /* ===================================================================== */
 
 /* ===================================================================== */
@@ -31,9 +98,208 @@ typedef std::vector<BTBPredictor *>::iterator btb_iterator_t;
 std::vector<RAS *> ras_vec;
 typedef std::vector<RAS *>::iterator ras_vec_iterator_t;
 
+//> Grids of Nbit/FSM/Global/Local configurations (*Sweep config entries),
+//  simulated in one pass and reported with the branch predictors.
+PredictorSweep sweep;
+
+//> Global and local histories shared by the predictors that are simulated
+//  one branch at a time, see BranchContext.
+BranchContext branch_context;
+
+#ifdef CSLAB_STATIC_PREDICTORS
+//> Compile-time predictor set, simulated without virtual calls instead of
+//  InitPredictors() when there is no -config file. Edit the list and
+//  rebuild; a -config file still selects the runtime classes, and then the
+//  set is not simulated. Reported with a "ct-" prefix, its names would
+//  otherwise repeat those of the runtime copies.
+typedef ct::PredictorSet<
+    ct::NbitPredictor<14, 2>,
+    ct::FSMPredictor<3>,
+    ct::LocalHistoryPredictor<2048, 8, 8192, 2>,
+    ct::GlobalHistoryPredictor<16384, 2, 2>,
+    ct::GlobalHistoryPredictor<8192, 4, 4>,
+    ct::Alpha21264Predictor,
+    ct::TournamentHybridPredictor<10, ct::NbitPredictor<13, 2>, ct::GlobalHistoryPredictor<8192, 2, 2>>>
+    static_predictor_set_t;
+static_predictor_set_t static_predictors;
+BOOL static_predictors_on = false; // no -config file
+
+// correct/incorrect: the counts to report from index next on, see Fini()
+struct static_predictor_report_t
+{
+    std::ofstream &out;
+    ResultsWriter &results;
+    UINT64 instructions;
+    const std::vector<UINT64> &correct, &incorrect;
+    size_t next;
+    template <typename P>
+    void operator()(P &predictor)
+    {
+        string name = "ct-" + predictor.getName();
+        out << "  " << name << ": " << correct[next] << " " << incorrect[next] << "\n";
+        results.add(ResultsWriter::BRANCH, name, predictor.getParams(), predictor.getStorageBits(),
+                    instructions, correct[next], incorrect[next], RESULTS_NONE);
+        next++;
+    }
+};
+
+struct static_predictor_reset_t
+{
+    template <typename P>
+    void operator()(P &predictor) { predictor.resetCounters(); }
+};
+
+struct static_predictor_counts_t
+{
+    std::vector<UINT64> &correct, &incorrect;
+    template <typename P>
+    void operator()(P &predictor)
+    {
+        correct.push_back(predictor.getNumCorrectPredictions());
+        incorrect.push_back(predictor.getNumIncorrectPredictions());
+    }
+};
+#endif
+
 UINT64 total_instructions;
 std::ofstream outFile;
 
+//> -json/-records: the results of Fini() in a stable, machine-readable form.
+ResultsWriter results;
+
+//> Same breakdown as cslab_branch_stats, gathered in the same run (-stats).
+struct branch_stats_s {
+    UINT64 total,
+           conditional[2], // [0] -> not taken, [1] -> taken
+           unconditional,
+           call,
+           ret;
+} branch_stats;
+
+BranchTraceWriter trace_writer;
+UINT64 traced_instructions; // total_instructions at the last trace record
+
+//> -skip and -max. They are checked at the start of every basic block, so
+//  the warm-up ends and the tool detaches at the first block boundary after
+//  the limit. Without them the blocks are counted with a plain call.
+BOOL instruction_events = false;
+BOOL warming_up = false;
+UINT64 next_event = ~0ULL; // total_instructions at which instruction_event() runs
+UINT64 next_limit = ~0ULL; // the next of the events above, or of -simpoints
+
+//> -roi_begin/-roi_end. Outside the region of interest nothing but the
+//  markers is instrumented, so the application runs at close to native
+//  speed; entering or leaving the region flushes the code cache with
+//  PIN_RemoveInstrumentation() and the next traces are instrumented again.
+BOOL in_roi = true;
+ADDRINT roi_begin_addr = 0, roi_end_addr = 0;
+
+//> -bbv and -simpoints, see simpoint.h. Between the sampled intervals only
+//  the instructions are counted (simulate_branches is false), switching
+//  flushes the code cache as for the ROI.
+BbvProfiler bbv;
+SimPointSampler sampler;
+BOOL simulate_branches = true;
+
+//> Weighted sums of the per-instruction rates of the measured intervals,
+//  scaled to the whole run in Fini(). One entry per row of the "Branch
+//  Predictors:" report, see branch_counts().
+struct sampled_stats_s {
+    UINT64 start;                             // total_instructions at the start of the interval
+    std::vector<UINT64> correct, incorrect;   // predictor counts at the start of the interval
+    std::vector<UINT64> end_correct, end_incorrect;
+    std::vector<double> correct_rate, incorrect_rate;
+    double weight;
+} sampled;
+
+//> -series. The rows are taken at the instruction events too, so the
+//  interval costs nothing more than -max; a PIN internal thread writes them.
+IntervalSeries series;
+UINT64 next_snapshot = ~0ULL;
+std::vector<UINT64> series_row;
+PIN_THREAD_UID series_writer_uid;
+std::atomic<bool> series_writer_stop(false);
+
+//> -profile, see branch_profile.h
+BranchProfile branch_profile;
+BOOL profile_branches = false;
+
+//> -threads. Every thread counts its instructions and branches in its own
+//  thread_state_t (Pin TLS), merged into the globals by Fini(), and has its
+//  own RAS copies, since call stacks are per thread. The predictors are
+//  either private (each thread simulates its own copies, no locking) or
+//  shared: one set of tables, under threads_lock, with the histories of
+//  the running thread swapped into branch_context. Not everything lives in
+//  the context; these see the branches of all threads interleaved in shared
+//  mode:
+//    - the Pentium-M path history
+//    - the TAGE folded histories
+//    - Global's folded BHR, when N > log2(PHT entries)
+//  The *Sweep grids keep a global history of their own and are rejected
+//  with -threads shared.
+enum threads_mode_t
+{
+    THREADS_OFF,
+    THREADS_PRIVATE,
+    THREADS_SHARED
+} threads_mode = THREADS_OFF;
+
+struct thread_state_t
+{
+    thread_state_t() : instructions(0), sweep(NULL) { memset(&stats, 0, sizeof(stats)); }
+
+    // Explicit padding (as in SpscRing) so that the counters of two threads
+    // never share a cache line
+    char pad0[64];
+    UINT64 instructions;
+    branch_stats_s stats;
+    char pad1[64];
+
+    std::vector<BranchPredictor *> branch_predictors; // private mode
+    std::vector<BTBPredictor *> btb_predictors;       // private mode
+    std::vector<RAS *> ras_vec;
+    PredictorSweep *sweep;                            // private mode
+    BranchContext context; // private: of its predictors, shared: swapped with branch_context
+};
+
+TLS_KEY thread_key = INVALID_TLS_KEY;
+std::vector<thread_state_t *> thread_states;
+PIN_LOCK threads_lock;                // thread_states, and the predictors in shared mode
+thread_state_t *context_owner = NULL; // shared: the thread whose histories are in branch_context
+
+//> Record filled inline by Pin in -buffered mode (see BufferFull()), and
+//  handed to the worker threads in -workers mode.
+struct branch_buffer_record_t
+{
+    ADDRINT ip;
+    ADDRINT target;
+    UINT32 flags; // BranchRecordFlags, without BR_TAKEN
+    UINT32 size;
+    BOOL taken;
+};
+
+BUFFER_ID branch_buffer = INVALID_BUFFER_ID;
+
+//> In -workers mode each worker owns a disjoint subset of the predictors and
+//  receives every branch through its own SPSC ring. A predictor only ever
+//  sees its branches in program order, so results match the serial path.
+struct worker_t
+{
+    worker_t(size_t ring_entries) : ring(ring_entries), sweep(NULL) {}
+
+    SpscRing<branch_buffer_record_t> ring;
+    std::vector<BranchPredictor *> branch_predictors;
+    std::vector<BTBPredictor *> btb_predictors;
+    std::vector<RAS *> ras_vec;
+    PredictorSweep *sweep; // the sweep is simulated by the first worker
+    PIN_THREAD_UID uid;
+};
+std::vector<worker_t *> workers;
+typedef std::vector<worker_t *>::iterator worker_iterator_t;
+
+std::atomic<bool> workers_stop(false);
+std::atomic<bool> workers_stopped(false);
+
 /* ===================================================================== */
 
 INT32 Usage()
@@ -51,6 +317,335 @@ VOID count_instruction()
     total_instructions++;
 }
 
+//> One call per basic block instead of per instruction, simple enough for Pin to inline.
+VOID count_bbl_instructions(UINT32 num_ins)
+{
+    total_instructions += num_ins;
+}
+
+//> Same as above, for the If/Then calls of -skip and -max.
+ADDRINT count_instruction_if()
+{
+    return ++total_instructions >= next_event;
+}
+
+ADDRINT count_bbl_instructions_if(UINT32 num_ins)
+{
+    total_instructions += num_ins;
+    return total_instructions >= next_event;
+}
+
+//> Clear every statistic at the end of the warm-up. Predictor tables and
+//  histories are kept, that is what the warm-up trained.
+VOID reset_statistics()
+{
+    total_instructions = 0;
+    memset(&branch_stats, 0, sizeof(branch_stats));
+
+    for (bp_iterator_t bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+        (*bp_it)->resetCounters();
+    for (btb_iterator_t btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it)
+        (*btb_it)->resetCounters();
+    for (ras_vec_iterator_t ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+        (*ras_it)->resetCounters();
+    sweep.resetCounters();
+    branch_profile.resetCounters();
+#ifdef CSLAB_STATIC_PREDICTORS
+    static_predictor_reset_t reset;
+    if (static_predictors_on)
+        static_predictors.forEach(reset);
+#endif
+}
+
+//> -save_state/-load_state, see predictor_state.h: the tables of the
+//  predictors, BTBs, RAS and *Sweep grids and the histories of
+//  branch_context. Predictors without checkpoint support (Pentium-M, the
+//  CSLAB_STATIC_PREDICTORS set) are left out and start cold.
+BOOL SaveState(const string &filename)
+{
+    PredictorStateWriter out;
+    out.begin("BranchContext");
+    branch_context.save(out);
+    out.end();
+
+    for (bp_iterator_t bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+    {
+        out.begin((*bp_it)->getName());
+        if ((*bp_it)->saveState(out))
+            out.end();
+        else
+            out.discard();
+    }
+    for (btb_iterator_t btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it)
+    {
+        out.begin((*btb_it)->getName());
+        (*btb_it)->saveState(out);
+        out.end();
+    }
+    for (size_t i = 0; i < ras_vec.size(); i++)
+    {
+        std::ostringstream name;
+        name << "RAS-" << i;
+        out.begin(name.str());
+        ras_vec[i]->saveState(out);
+        out.end();
+    }
+    if (!sweep.empty())
+    {
+        out.begin("PredictorSweep");
+        sweep.save(out);
+        out.end();
+    }
+    return out.write(filename);
+}
+
+//> Predictors missing from the file start cold, with a warning.
+BOOL LoadState(const string &filename, string &error)
+{
+    PredictorStateReader in;
+    if (!in.open(filename, error))
+        return false;
+    if (!in.begin("BranchContext") || !branch_context.load(in) || !in.end())
+    {
+        error = "the histories of " + filename + " are not those of these predictors";
+        return false;
+    }
+
+    for (size_t i = 0; i < branch_predictors.size() + btb_predictors.size(); i++)
+    {
+        BranchPredictor *bp = (i < branch_predictors.size()) ? branch_predictors[i]
+                                                               : btb_predictors[i - branch_predictors.size()];
+        if (!in.begin(bp->getName()))
+        {
+            cerr << "Warning: no state of " << bp->getName() << " in " << filename << ", it starts cold" << endl;
+            continue;
+        }
+        if (!bp->loadState(in) || !in.end())
+        {
+            error = "the state of " + bp->getName() + " in " + filename + " does not match the predictor";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < ras_vec.size(); i++)
+    {
+        std::ostringstream name;
+        name << "RAS-" << i;
+        if (!in.begin(name.str()) || !ras_vec[i]->loadState(in) || !in.end())
+        {
+            error = "the state of " + name.str() + " in " + filename + " does not match the RAS";
+            return false;
+        }
+    }
+    if (sweep.empty())
+        return true;
+    if (!in.begin("PredictorSweep"))
+        cerr << "Warning: no state of the *Sweep grids in " << filename << ", they start cold" << endl;
+    else if (!sweep.load(in) || !in.end())
+    {
+        error = "the *Sweep state in " + filename + " does not match the grids";
+        return false;
+    }
+    return true;
+}
+
+//> Checkpoint of a -simpoints interval about to be measured: written with
+//  -save_state, restored instead of the warm-up with -load_state.
+VOID simpoint_checkpoint()
+{
+    std::ostringstream file;
+    string error;
+    if (!KnobLoadState.Value().empty())
+    {
+        file << KnobLoadState.Value() << "." << sampler.currentInterval();
+        if (!LoadState(file.str(), error))
+        {
+            cerr << "Error: " << error << endl;
+            PIN_ExitApplication(1);
+        }
+    }
+    else if (!KnobSaveState.Value().empty())
+    {
+        file << KnobSaveState.Value() << "." << sampler.currentInterval();
+        if (!SaveState(file.str()))
+        {
+            cerr << "Error: could not write " << file.str() << endl;
+            PIN_ExitApplication(1);
+        }
+    }
+}
+
+//> The counts of every row of the "Branch Predictors:" report, in its
+//  order: branch_predictors, the *Sweep grids, the CSLAB_STATIC_PREDICTORS
+//  set. The vectors are reused.
+VOID branch_counts(std::vector<UINT64> &correct, std::vector<UINT64> &incorrect)
+{
+    correct.clear();
+    incorrect.clear();
+    for (size_t i = 0; i < branch_predictors.size(); i++)
+    {
+        correct.push_back(branch_predictors[i]->getNumCorrectPredictions());
+        incorrect.push_back(branch_predictors[i]->getNumIncorrectPredictions());
+    }
+    for (size_t i = 0; i < sweep.size(); i++)
+    {
+        correct.push_back(sweep.getNumCorrectPredictions(i));
+        incorrect.push_back(sweep.getNumIncorrectPredictions(i));
+    }
+#ifdef CSLAB_STATIC_PREDICTORS
+    static_predictor_counts_t counts = {correct, incorrect};
+    if (static_predictors_on)
+        static_predictors.forEach(counts);
+#endif
+}
+
+VOID begin_sampled_interval()
+{
+    sampled.start = total_instructions;
+    branch_counts(sampled.correct, sampled.incorrect);
+}
+
+VOID end_sampled_interval()
+{
+    UINT64 instructions = total_instructions - sampled.start;
+    if (instructions == 0)
+        return;
+
+    double w = sampler.weight();
+    branch_counts(sampled.end_correct, sampled.end_incorrect);
+    for (size_t i = 0; i < sampled.correct_rate.size(); i++)
+    {
+        UINT64 correct = sampled.end_correct[i] - sampled.correct[i];
+        UINT64 incorrect = sampled.end_incorrect[i] - sampled.incorrect[i];
+        sampled.correct_rate[i] += w * correct / instructions;
+        sampled.incorrect_rate[i] += w * incorrect / instructions;
+    }
+    sampled.weight += w;
+}
+
+//> Phase change of -simpoints: fast-forward, warm-up, measure.
+VOID simpoint_event()
+{
+    if (sampler.getPhase() == SimPointSampler::MEASURE)
+        end_sampled_interval();
+    sampler.advance(total_instructions);
+    if (sampler.getPhase() == SimPointSampler::MEASURE)
+    {
+        simpoint_checkpoint();
+        begin_sampled_interval();
+    }
+
+    BOOL simulate = sampler.getPhase() == SimPointSampler::WARMUP ||
+                    sampler.getPhase() == SimPointSampler::MEASURE;
+    if (simulate != simulate_branches)
+    {
+        simulate_branches = simulate;
+        PIN_RemoveInstrumentation();
+    }
+    next_limit = sampler.nextEvent();
+}
+
+VOID series_snapshot()
+{
+    series_row[0] = total_instructions;
+    for (size_t i = 0; i < branch_predictors.size(); i++)
+        series_row[i + 1] = branch_predictors[i]->getNumIncorrectPredictions();
+    series.push(&series_row[0]);
+}
+
+//> total_instructions reached next_event: a -series row, the end of the
+//  warm-up (-skip), the -max limit or a -simpoints phase change.
+VOID instruction_event()
+{
+    if (total_instructions >= next_snapshot)
+    {
+        series_snapshot();
+        next_snapshot = total_instructions + series.getInterval();
+    }
+    if (total_instructions >= next_limit)
+    {
+        if (sampler.active())
+            simpoint_event();
+        else if (warming_up)
+        {
+            warming_up = false;
+            reset_statistics();
+            next_limit = KnobMaxInstructions.Value() ? KnobMaxInstructions.Value() : ~0ULL;
+            if (series.isOpen())
+                next_snapshot = series.getInterval();
+        }
+        else
+        {
+            next_limit = ~0ULL;
+            PIN_Detach();
+        }
+    }
+    next_event = (next_limit < next_snapshot) ? next_limit : next_snapshot;
+}
+
+VOID bbv_count(UINT32 id, UINT32 num_ins)
+{
+    bbv.count(id, num_ins, total_instructions);
+}
+
+VOID roi_begin()
+{
+    if (!in_roi)
+    {
+        in_roi = true;
+        PIN_RemoveInstrumentation();
+    }
+}
+
+VOID roi_end()
+{
+    if (in_roi)
+    {
+        in_roi = false;
+        PIN_RemoveInstrumentation();
+    }
+}
+
+//> Find the ROI markers in every image as it is loaded.
+VOID Image(IMG img, VOID *v)
+{
+    if (!KnobRoiBegin.Value().empty())
+    {
+        RTN rtn = RTN_FindByName(img, KnobRoiBegin.Value().c_str());
+        if (RTN_Valid(rtn))
+            roi_begin_addr = RTN_Address(rtn);
+    }
+    if (!KnobRoiEnd.Value().empty())
+    {
+        RTN rtn = RTN_FindByName(img, KnobRoiEnd.Value().c_str());
+        if (RTN_Valid(rtn))
+            roi_end_addr = RTN_Address(rtn);
+    }
+}
+
+VOID stats_call_instruction()
+{
+    branch_stats.call++;
+    branch_stats.total++;
+}
+
+VOID stats_ret_instruction()
+{
+    branch_stats.ret++;
+    branch_stats.total++;
+}
+
+VOID stats_conditional_instruction(BOOL taken)
+{
+    branch_stats.conditional[taken]++;
+    branch_stats.total++;
+}
+
+VOID stats_unconditional_instruction()
+{
+    branch_stats.unconditional++;
+    branch_stats.total++;
+}
+
 VOID call_instruction(ADDRINT ip, ADDRINT target, UINT32 ins_size)
 {
     ras_vec_iterator_t ras_it;
@@ -76,32 +671,458 @@ VOID ret_instruction(ADDRINT ip, ADDRINT target)
 VOID cond_branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken)
 {
     bp_iterator_t bp_it;
-    BOOL pred;
+
+    branch_context.begin(ip);
 
     for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
     {
         BranchPredictor *curr_predictor = *bp_it;
-        pred = curr_predictor->predict(ip, target);
-        curr_predictor->update(pred, taken, ip, target);
+        curr_predictor->predictAndUpdate(ip, target, taken);
     }
+    branch_context.end(taken);
+    if (!sweep.empty())
+        sweep.step(ip, taken);
+
+#ifdef CSLAB_STATIC_PREDICTORS
+    if (static_predictors_on)
+        static_predictors.step(ip, target, taken);
+#endif
+}
+
+#ifdef CSLAB_STATIC_PREDICTORS
+//> Same as above when only the compile-time set is simulated: no virtual
+//  calls, and no branch_context, which it does not use.
+VOID static_cond_branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken)
+{
+    static_predictors.step(ip, target, taken);
+}
+#endif
+
+//> Same as above, also counted per static branch (-profile).
+VOID cond_branch_instruction_profiled(ADDRINT ip, ADDRINT target, BOOL taken, UINT32 id)
+{
+    UINT64 *counts = branch_profile.counts(id);
+    counts[0]++;
+    counts[1] += taken;
+
+    branch_context.begin(ip);
+
+    for (size_t i = 0; i < branch_predictors.size(); i++)
+        counts[2 + i] += branch_predictors[i]->predictAndUpdate(ip, target, taken) != (bool)taken;
+    branch_context.end(taken);
+    if (!sweep.empty())
+        sweep.step(ip, taken);
+
+#ifdef CSLAB_STATIC_PREDICTORS
+    if (static_predictors_on)
+        static_predictors.step(ip, target, taken);
+#endif
 }
 
 VOID branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken)
 {
     btb_iterator_t btb_it;
-    BOOL pred;
 
     for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it)
     {
         BTBPredictor *curr_predictor = *btb_it;
-        pred = curr_predictor->predict(ip, target);
-        curr_predictor->update(pred, taken, ip, target);
+        curr_predictor->predictAndUpdate(ip, target, taken);
     }
 }
 
-VOID Instruction(INS ins, void *v)
+/* ===================================================================== */
+/* -threads analysis routines                                            */
+/* ===================================================================== */
+inline thread_state_t *thread_state(THREADID tid)
+{
+    return static_cast<thread_state_t *>(PIN_GetThreadData(thread_key, tid));
+}
+
+VOID thread_count_instruction(THREADID tid)
+{
+    thread_state(tid)->instructions++;
+}
+
+VOID thread_count_bbl_instructions(THREADID tid, UINT32 num_ins)
+{
+    thread_state(tid)->instructions += num_ins;
+}
+
+enum stats_kind_t
+{
+    STATS_CONDITIONAL,
+    STATS_UNCONDITIONAL,
+    STATS_CALL,
+    STATS_RET,
+    STATS_NONE
+};
+
+VOID thread_stats_instruction(THREADID tid, UINT32 kind, BOOL taken)
+{
+    branch_stats_s &stats = thread_state(tid)->stats;
+    if (kind == STATS_CONDITIONAL)
+        stats.conditional[taken]++;
+    else if (kind == STATS_UNCONDITIONAL)
+        stats.unconditional++;
+    else if (kind == STATS_CALL)
+        stats.call++;
+    else
+        stats.ret++;
+    stats.total++;
+}
+
+VOID thread_call_instruction(THREADID tid, ADDRINT ip, UINT32 ins_size)
+{
+    std::vector<RAS *> &ras = thread_state(tid)->ras_vec;
+    for (size_t i = 0; i < ras.size(); i++)
+        ras[i]->push_addr(ip + ins_size);
+}
+
+VOID thread_ret_instruction(THREADID tid, ADDRINT target)
+{
+    std::vector<RAS *> &ras = thread_state(tid)->ras_vec;
+    for (size_t i = 0; i < ras.size(); i++)
+        ras[i]->pop_addr(target);
+}
+
+//> Shared mode: take the predictors and put the thread's histories in
+//  branch_context, saving those of the previous thread.
+VOID lock_shared_predictors(THREADID tid)
+{
+    PIN_GetLock(&threads_lock, tid + 1);
+
+    thread_state_t *ts = thread_state(tid);
+    if (context_owner != ts)
+    {
+        if (context_owner)
+            branch_context.swap(context_owner->context);
+        branch_context.swap(ts->context);
+        context_owner = ts;
+    }
+}
+
+VOID thread_cond_branch_instruction(THREADID tid, ADDRINT ip, ADDRINT target, BOOL taken)
+{
+    if (threads_mode == THREADS_SHARED)
+    {
+        lock_shared_predictors(tid);
+        cond_branch_instruction(ip, target, taken);
+        PIN_ReleaseLock(&threads_lock);
+        return;
+    }
+
+    thread_state_t *ts = thread_state(tid);
+    ts->context.begin(ip);
+    for (size_t i = 0; i < ts->branch_predictors.size(); i++)
+        ts->branch_predictors[i]->predictAndUpdate(ip, target, taken);
+    ts->context.end(taken);
+    if (!ts->sweep->empty())
+        ts->sweep->step(ip, taken);
+}
+
+VOID thread_branch_instruction(THREADID tid, ADDRINT ip, ADDRINT target, BOOL taken)
+{
+    if (threads_mode == THREADS_SHARED)
+    {
+        PIN_GetLock(&threads_lock, tid + 1);
+        branch_instruction(ip, target, taken);
+        PIN_ReleaseLock(&threads_lock);
+        return;
+    }
+
+    std::vector<BTBPredictor *> &btbs = thread_state(tid)->btb_predictors;
+    for (size_t i = 0; i < btbs.size(); i++)
+        btbs[i]->predictAndUpdate(ip, target, taken);
+}
+
+//> Simulate a batch of branches predictor by predictor, so that each
+//  predictor's tables stay in cache for the whole batch. Predictors do not
+//  share state, so the results are identical to the per-branch analysis calls.
+VOID simulate_batch(const branch_buffer_record_t *recs, UINT64 num_recs,
+                    std::vector<BranchPredictor *> &bps, std::vector<BTBPredictor *> &btbs,
+                    std::vector<RAS *> &rases, PredictorSweep *grid)
+{
+    const branch_buffer_record_t *end = recs + num_recs;
+    const branch_buffer_record_t *rec;
+
+    for (bp_iterator_t bp_it = bps.begin(); bp_it != bps.end(); ++bp_it)
+    {
+        BranchPredictor *curr_predictor = *bp_it;
+        for (rec = recs; rec != end; ++rec)
+        {
+            if (!(rec->flags & BR_COND))
+                continue;
+            curr_predictor->predictAndUpdate(rec->ip, rec->target, rec->taken);
+        }
+    }
+
+    if (grid && !grid->empty())
+    {
+        for (rec = recs; rec != end; ++rec)
+            if (rec->flags & BR_COND)
+                grid->step(rec->ip, rec->taken);
+    }
+
+    for (btb_iterator_t btb_it = btbs.begin(); btb_it != btbs.end(); ++btb_it)
+    {
+        BTBPredictor *curr_predictor = *btb_it;
+        for (rec = recs; rec != end; ++rec)
+        {
+            if (!(rec->flags & BR_BTB))
+                continue;
+            curr_predictor->predictAndUpdate(rec->ip, rec->target, rec->taken);
+        }
+    }
+
+    for (ras_vec_iterator_t ras_it = rases.begin(); ras_it != rases.end(); ++ras_it)
+    {
+        RAS *ras = *ras_it;
+        for (rec = recs; rec != end; ++rec)
+        {
+            if (rec->flags & BR_CALL)
+                ras->push_addr(rec->ip + rec->size);
+            else if (rec->flags & BR_RET)
+                ras->pop_addr(rec->target);
+        }
+    }
+}
+
+//> Simulate everything that is left in a worker's ring on the calling thread.
+VOID drain_worker(worker_t *w)
+{
+    const branch_buffer_record_t *recs;
+    UINT64 n;
+
+    while ((n = w->ring.peek(recs)) != 0)
+    {
+        simulate_batch(recs, n, w->branch_predictors, w->btb_predictors, w->ras_vec, w->sweep);
+        w->ring.consume(n);
+    }
+}
+
+//> Hand a batch to every worker. When a ring is full the app thread waits
+//  for its worker (backpressure); after the workers have been stopped it
+//  drains the ring itself.
+VOID push_to_workers(const branch_buffer_record_t *recs, UINT64 num_recs)
+{
+    for (worker_iterator_t w_it = workers.begin(); w_it != workers.end(); ++w_it)
+    {
+        worker_t *w = *w_it;
+        UINT64 pushed = 0;
+
+        while ((pushed += w->ring.push(recs + pushed, num_recs - pushed)) < num_recs)
+        {
+            if (workers_stopped.load(std::memory_order_acquire))
+                drain_worker(w);
+            else
+                PIN_Yield();
+        }
+    }
+}
+
+VOID drain_branch_buffer(const branch_buffer_record_t *recs, UINT64 num_recs)
+{
+#ifdef CSLAB_STATIC_PREDICTORS
+    if (static_predictors_on)
+        for (UINT64 i = 0; i < num_recs; i++)
+            if (recs[i].flags & BR_COND)
+                static_predictors.step(recs[i].ip, recs[i].target, recs[i].taken);
+#endif
+    if (!workers.empty())
+        push_to_workers(recs, num_recs);
+    else
+        simulate_batch(recs, num_recs, branch_predictors, btb_predictors, ras_vec, &sweep);
+}
+
+VOID enqueue_branch(UINT32 flags, ADDRINT ip, ADDRINT target, BOOL taken, UINT32 ins_size)
+{
+    branch_buffer_record_t rec = {ip, target, flags, ins_size, taken};
+    drain_branch_buffer(&rec, 1);
+}
+
+VOID WorkerThread(VOID *arg)
+{
+    worker_t *w = static_cast<worker_t *>(arg);
+    const branch_buffer_record_t *recs;
+    UINT64 n;
+
+    while (true)
+    {
+        n = w->ring.peek(recs);
+        if (n != 0)
+        {
+            simulate_batch(recs, n, w->branch_predictors, w->btb_predictors, w->ras_vec, w->sweep);
+            w->ring.consume(n);
+        }
+        else if (workers_stop.load(std::memory_order_acquire))
+            break;
+        else
+            PIN_Yield();
+    }
+}
+
+//> Writes the -series rows, the application thread only fills the ring.
+VOID SeriesWriterThread(VOID *arg)
+{
+    while (!series_writer_stop.load(std::memory_order_acquire))
+        if (!series.drain())
+            PIN_Sleep(10);
+}
+
+VOID *BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf,
+                 UINT64 numElements, VOID *v)
+{
+    drain_branch_buffer(static_cast<branch_buffer_record_t *>(buf), numElements);
+    return buf;
+}
+
+//> Which of the analysis routines below an instruction triggers.
+UINT32 BranchFlags(INS ins)
+{
+    UINT32 flags = 0;
+
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+        flags |= BR_COND;
+    else if (INS_IsCall(ins))
+        flags |= BR_CALL;
+    else if (INS_IsRet(ins))
+        flags |= BR_RET;
+    // For BTB we instrument all branches except returns
+    if (INS_IsBranch(ins) && !INS_IsRet(ins))
+        flags |= BR_BTB;
+    return flags;
+}
+
+VOID trace_branch(UINT32 flags, ADDRINT ip, ADDRINT target, BOOL taken, UINT32 ins_size)
+{
+    trace_writer.append(flags | (taken ? BR_TAKEN : 0), total_instructions - traced_instructions,
+                        ip, target, ins_size);
+    traced_instructions = total_instructions;
+}
+
+VOID TraceInstruction(INS ins)
+{
+    UINT32 flags = BranchFlags(ins);
+
+    if (flags)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)trace_branch,
+                       IARG_UINT32, flags, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                       IARG_BRANCH_TAKEN, IARG_UINT32, INS_Size(ins), IARG_END);
+}
+
+//> Same classification as Instruction() in cslab_branch_stats.cpp
+VOID StatsInstruction(INS ins)
 {
     if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)stats_conditional_instruction,
+                       IARG_BRANCH_TAKEN, IARG_END);
+    else if (INS_Category(ins) == XED_CATEGORY_UNCOND_BR)
+        INS_InsertCall(ins, IPOINT_BEFORE,
+                       (AFUNPTR)stats_unconditional_instruction, IARG_END);
+    else if (INS_IsCall(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)stats_call_instruction, IARG_END);
+    else if (INS_IsRet(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)stats_ret_instruction, IARG_END);
+}
+
+//> Instruction() of the -threads mode, the analysis routines get the thread.
+VOID ThreadedInstruction(INS ins)
+{
+    if (KnobStats.Value())
+    {
+        // Same classification as StatsInstruction()
+        UINT32 kind = STATS_NONE;
+        if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+            kind = STATS_CONDITIONAL;
+        else if (INS_Category(ins) == XED_CATEGORY_UNCOND_BR)
+            kind = STATS_UNCONDITIONAL;
+        else if (INS_IsCall(ins))
+            kind = STATS_CALL;
+        else if (INS_IsRet(ins))
+            kind = STATS_RET;
+        if (kind != STATS_NONE)
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_stats_instruction,
+                           IARG_THREAD_ID, IARG_UINT32, kind, IARG_BRANCH_TAKEN, IARG_END);
+    }
+
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_cond_branch_instruction,
+                       IARG_THREAD_ID, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                       IARG_BRANCH_TAKEN, IARG_END);
+    else if (INS_IsCall(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_call_instruction,
+                       IARG_THREAD_ID, IARG_INST_PTR, IARG_UINT32, INS_Size(ins), IARG_END);
+    else if (INS_IsRet(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_ret_instruction,
+                       IARG_THREAD_ID, IARG_BRANCH_TARGET_ADDR, IARG_END);
+
+    // For BTB we instrument all branches except returns
+    if (INS_IsBranch(ins) && !INS_IsRet(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_branch_instruction,
+                       IARG_THREAD_ID, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                       IARG_BRANCH_TAKEN, IARG_END);
+}
+
+VOID Instruction(INS ins, void *v)
+{
+    if (threads_mode != THREADS_OFF)
+    {
+        ThreadedInstruction(ins);
+        return;
+    }
+
+    if (KnobStats.Value())
+        StatsInstruction(ins);
+
+    if (trace_writer.isOpen())
+    {
+        TraceInstruction(ins);
+        if (KnobTraceOnly.Value())
+            return;
+    }
+
+    if (branch_buffer != INVALID_BUFFER_ID)
+    {
+        UINT32 flags = BranchFlags(ins);
+        if (flags)
+            INS_InsertFillBuffer(ins, IPOINT_BEFORE, branch_buffer,
+                                 IARG_INST_PTR, offsetof(branch_buffer_record_t, ip),
+                                 IARG_BRANCH_TARGET_ADDR, offsetof(branch_buffer_record_t, target),
+                                 IARG_UINT32, flags, offsetof(branch_buffer_record_t, flags),
+                                 IARG_UINT32, INS_Size(ins), offsetof(branch_buffer_record_t, size),
+                                 IARG_BRANCH_TAKEN, offsetof(branch_buffer_record_t, taken),
+                                 IARG_END);
+        return;
+    }
+
+    if (!workers.empty())
+    {
+        UINT32 flags = BranchFlags(ins);
+        if (flags)
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)enqueue_branch,
+                           IARG_UINT32, flags, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                           IARG_BRANCH_TAKEN, IARG_UINT32, INS_Size(ins), IARG_END);
+        return;
+    }
+
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR && profile_branches)
+    {
+        // Symbols are looked up now, the image may be gone by Fini()
+        RTN rtn = INS_Rtn(ins);
+        string routine = RTN_Valid(rtn) ? RTN_Name(rtn) : "?";
+        ADDRINT offset = INS_Address(ins) - (RTN_Valid(rtn) ? RTN_Address(rtn) : 0);
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)cond_branch_instruction_profiled,
+                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
+                       IARG_UINT32, branch_profile.id(INS_Address(ins), routine, offset),
+                       IARG_END);
+    }
+#ifdef CSLAB_STATIC_PREDICTORS
+    else if (INS_Category(ins) == XED_CATEGORY_COND_BR && static_predictors_on)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)static_cond_branch_instruction,
+                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
+                       IARG_END);
+#endif
+    else if (INS_Category(ins) == XED_CATEGORY_COND_BR)
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)cond_branch_instruction,
                        IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
                        IARG_END);
@@ -118,39 +1139,220 @@ VOID Instruction(INS ins, void *v)
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)branch_instruction,
                        IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
                        IARG_END);
+}
 
-    // Count each and every instruction
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+//> Count each and every instruction, a whole basic block at a time.
+//  REP instructions execute IPOINT_BEFORE calls once per iteration, so they
+//  keep their own count_instruction() call and the total is the same as with
+//  a call before every instruction. The block count is inserted first, so it
+//  runs before the branch analysis calls of a single-instruction block.
+VOID Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        // The ROI markers are instrumented inside and outside the region
+        if (roi_begin_addr && BBL_Address(bbl) == roi_begin_addr)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)roi_begin, IARG_END);
+        if (roi_end_addr && BBL_Address(bbl) == roi_end_addr)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)roi_end, IARG_END);
+        if (!in_roi)
+            continue;
+
+        if (bbv.isOpen())
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)bbv_count,
+                           IARG_UINT32, bbv.blockId(BBL_Address(bbl)),
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+
+        UINT32 num_ins = 0;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            if (!INS_HasRealRep(ins))
+                num_ins++;
+        if (num_ins && threads_mode != THREADS_OFF)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)thread_count_bbl_instructions,
+                           IARG_THREAD_ID, IARG_UINT32, num_ins, IARG_END);
+        else if (num_ins && instruction_events)
+        {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_bbl_instructions_if,
+                             IARG_UINT32, num_ins, IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)instruction_event, IARG_END);
+        }
+        else if (num_ins)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_bbl_instructions,
+                           IARG_UINT32, num_ins, IARG_END);
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if (INS_HasRealRep(ins) && threads_mode != THREADS_OFF)
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_count_instruction,
+                               IARG_THREAD_ID, IARG_END);
+            else if (INS_HasRealRep(ins) && instruction_events)
+            {
+                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction_if, IARG_END);
+                INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)instruction_event, IARG_END);
+            }
+            else if (INS_HasRealRep(ins))
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+            if (simulate_branches)
+                Instruction(ins, v);
+        }
+    }
 }
 
 /* ===================================================================== */
 
+//> Internal threads must be stopped before Fini() is called.
+VOID PrepareForFini(VOID *v)
+{
+    workers_stop.store(true, std::memory_order_release);
+    for (worker_iterator_t w_it = workers.begin(); w_it != workers.end(); ++w_it)
+        PIN_WaitForThreadTermination((*w_it)->uid, PIN_INFINITE_TIMEOUT, NULL);
+    workers_stopped.store(true, std::memory_order_release);
+
+    if (series.isOpen())
+    {
+        series_writer_stop.store(true, std::memory_order_release);
+        PIN_WaitForThreadTermination(series_writer_uid, PIN_INFINITE_TIMEOUT, NULL);
+        series.stop();
+    }
+}
+
+//> Add the counters of a -threads thread to the globals.
+VOID merge_thread_state(thread_state_t *ts)
+{
+    total_instructions += ts->instructions;
+    branch_stats.total += ts->stats.total;
+    branch_stats.conditional[0] += ts->stats.conditional[0];
+    branch_stats.conditional[1] += ts->stats.conditional[1];
+    branch_stats.unconditional += ts->stats.unconditional;
+    branch_stats.call += ts->stats.call;
+    branch_stats.ret += ts->stats.ret;
+
+    for (size_t i = 0; i < ras_vec.size(); i++)
+        ras_vec[i]->mergeCounters(*ts->ras_vec[i]);
+    if (threads_mode != THREADS_PRIVATE)
+        return;
+    for (size_t i = 0; i < branch_predictors.size(); i++)
+        branch_predictors[i]->mergeCounters(*ts->branch_predictors[i]);
+    for (size_t i = 0; i < btb_predictors.size(); i++)
+        btb_predictors[i]->mergeCounters(*ts->btb_predictors[i]);
+    sweep.mergeCounters(*ts->sweep);
+}
+
 VOID Fini(int code, VOID *v)
 {
     bp_iterator_t bp_it;
     btb_iterator_t btb_it;
     ras_vec_iterator_t ras_it;
 
+    for (size_t i = 0; i < thread_states.size(); i++)
+        merge_thread_state(thread_states[i]);
+
+    if (trace_writer.isOpen() && !trace_writer.close(total_instructions - traced_instructions))
+        cerr << "Error: could not write the -trace file " << KnobTraceFile.Value() << endl;
+    if (bbv.isOpen())
+        bbv.close();
+    if (sampler.getPhase() == SimPointSampler::MEASURE)
+        end_sampled_interval();
+    if (series.isOpen())
+    {
+        // The last, partial interval
+        if (total_instructions + series.getInterval() > next_snapshot)
+            series_snapshot();
+        series.close();
+    }
+
+    // Workers have already terminated in PrepareForFini(), simulate whatever
+    // was pushed after that.
+    for (worker_iterator_t w_it = workers.begin(); w_it != workers.end(); ++w_it)
+        drain_worker(*w_it);
+
     // Report total instructions and total cycles
     outFile << "Total Instructions: " << total_instructions << "\n";
     outFile << "\n";
 
+    // The branch predictor counts below are then weighted estimates for the
+    // whole run, everything else covers the simulated instructions only
+    if (sampler.active())
+    {
+        outFile << "SimPoints: " << sampler.size() << " intervals of " << KnobInterval.Value() << " instructions, ";
+        if (KnobLoadState.Value().empty())
+            outFile << "warm-up " << KnobWarmup.Value();
+        else
+            outFile << "restored from " << KnobLoadState.Value() << ".*";
+        outFile << ", weight " << sampled.weight << "\n";
+        outFile << "\n";
+    }
+
+    if (KnobStats.Value())
+    {
+        outFile << "Branch statistics:\n";
+        outFile << "  Total-Branches: " << branch_stats.total << "\n";
+        outFile << "  Conditional-Taken-Branches: " << branch_stats.conditional[1] << "\n";
+        outFile << "  Conditional-NotTaken-Branches: " << branch_stats.conditional[0] << "\n";
+        outFile << "  Unconditional-Branches: " << branch_stats.unconditional << "\n";
+        outFile << "  Calls: " << branch_stats.call << "\n";
+        outFile << "  Returns: " << branch_stats.ret << "\n";
+        outFile << "\n";
+    }
+
     outFile << "RAS: (Correct - Incorrect)\n";
     for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
     {
         RAS *ras = *ras_it;
-        outFile << ras->getNameAndStats() << "\n";
+        for (size_t i = 0; i < ras->getNumDepths(); i++)
+            outFile << ras->getNameAndStats(i) << "\n";
     }
     outFile << "\n";
 
+    if (!ras_vec.empty())
+    {
+        outFile << "RAS Overflows: (Name - Overflows - OverflowIncorrect - UnderflowIncorrect)\n";
+        for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+        {
+            RAS *ras = *ras_it;
+            for (size_t i = 0; i < ras->getNumDepths(); i++)
+                outFile << ras->getOverflowStats(i) << "\n";
+        }
+        outFile << "\n";
+    }
+
+    // Only the rows of "Branch Predictors:" have estimates for the whole of a
+    // -simpoints run, the BTB counts cover an unknown part of it and get no MPKI
+    UINT64 measured_instructions = sampler.active() ? RESULTS_NONE : total_instructions;
+
+    // Every row of the section, see branch_counts()
+    std::vector<UINT64> correct, incorrect;
+    branch_counts(correct, incorrect);
+    if (sampler.active() && sampled.weight > 0)
+    {
+        double scale = total_instructions / sampled.weight;
+        for (size_t k = 0; k < correct.size(); k++)
+        {
+            correct[k] = (UINT64)(sampled.correct_rate[k] * scale + 0.5);
+            incorrect[k] = (UINT64)(sampled.incorrect_rate[k] * scale + 0.5);
+        }
+    }
+
     outFile << "Branch Predictors: (Name - Correct - Incorrect)\n";
-    for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+    for (size_t i = 0; i < branch_predictors.size(); i++)
     {
-        BranchPredictor *curr_predictor = *bp_it;
-        outFile << "  " << curr_predictor->getName() << ": "
-                << curr_predictor->getNumCorrectPredictions() << " "
-                << curr_predictor->getNumIncorrectPredictions() << "\n";
+        BranchPredictor *curr_predictor = branch_predictors[i];
+        outFile << "  " << curr_predictor->getName() << ": " << correct[i] << " " << incorrect[i] << "\n";
+        results.add(ResultsWriter::BRANCH, curr_predictor->getName(), curr_predictor->getParams(),
+                    curr_predictor->getStorageBits(), total_instructions, correct[i], incorrect[i], RESULTS_NONE);
     }
+    for (size_t i = 0, k = branch_predictors.size(); i < sweep.size(); i++, k++)
+    {
+        outFile << "  " << sweep.getName(i) << ": " << correct[k] << " " << incorrect[k] << "\n";
+        results.add(ResultsWriter::BRANCH, sweep.getName(i), sweep.getParams(i), sweep.getStorageBits(i),
+                    total_instructions, correct[k], incorrect[k], RESULTS_NONE);
+    }
+#ifdef CSLAB_STATIC_PREDICTORS
+    static_predictor_report_t report = {outFile, results, total_instructions, correct, incorrect,
+                                        branch_predictors.size() + sweep.size()};
+    if (static_predictors_on)
+        static_predictors.forEach(report);
+#endif
     outFile << "\n";
 
     outFile << "BTB Predictors: (Name - Correct - Incorrect - TargetCorrect)\n";
@@ -161,14 +1363,43 @@ VOID Fini(int code, VOID *v)
                 << curr_predictor->getNumCorrectPredictions() << " "
                 << curr_predictor->getNumIncorrectPredictions() << " "
                 << curr_predictor->getNumCorrectTargetPredictions() << "\n";
+        results.add(ResultsWriter::BTB, curr_predictor->getName(), curr_predictor->getParams(),
+                    curr_predictor->getStorageBits(), measured_instructions,
+                    curr_predictor->getNumCorrectPredictions(), curr_predictor->getNumIncorrectPredictions(),
+                    curr_predictor->getNumCorrectTargetPredictions());
     }
 
     outFile.close();
+    if (results.isOpen() && !results.close())
+        cerr << "Error: could not write the -json/-records results" << endl;
+
+    // After a -simpoints run the tables are those of the last interval,
+    // its checkpoint was written already
+    if (!KnobSaveState.Value().empty() && !sampler.active() && !SaveState(KnobSaveState.Value()))
+        cerr << "Error: could not write " << KnobSaveState.Value() << endl;
+
+    if (profile_branches)
+    {
+        std::ofstream profileFile(KnobProfileFile.Value().c_str());
+        std::vector<string> names;
+        for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+            names.push_back((*bp_it)->getName());
+        branch_profile.report(profileFile, names, KnobProfileTop.Value());
+    }
+}
+
+//> Fini() is not called after PIN_Detach() (-max), report here instead.
+VOID Detach(VOID *v)
+{
+    if (!workers.empty() || series.isOpen())
+        PrepareForFini(v);
+    Fini(0, v);
 }
 
 /* ===================================================================== */
 
-VOID InitPredictors()
+VOID InitPredictors(std::vector<BranchPredictor *> &branch_predictors,
+                    std::vector<BTBPredictor *> &btb_predictors)
 {
     /* Question 5.3 (i)
     // N-bit predictors
@@ -287,15 +1518,79 @@ VOID InitPredictors()
     //         new LocalHistoryPredictor(8192, 2, 8192, 2)));
 }
 
+//> Predictors only available inside the pintool, for -config files.
+BranchPredictor *CreatePintoolPredictor(const PredictorSpec &spec)
+{
+    if ((spec.name == "PentiumM" || spec.name == "PentiumMBranchPredictor") && spec.args.empty())
+        return new PentiumMBranchPredictor();
+    return NULL;
+}
+
+//> Contents of the -config file, read once by main(). The private copies of
+//  -threads private are built from it, not from a file that may have changed.
+string config_text;
+
+//> The predictors and RAS of the -config file if given, else of InitPredictors().
+BOOL CreatePredictors(std::vector<BranchPredictor *> &bps, std::vector<BTBPredictor *> &btbs,
+                      std::vector<RAS *> &ras, PredictorSweep &grid, string &error)
+{
+    if (KnobConfigFile.Value().empty())
+    {
+#ifndef CSLAB_STATIC_PREDICTORS
+        InitPredictors(bps, btbs);
+#endif
+        // InitRas();
+        return true;
+    }
+    PredictorFactory factory(CreatePintoolPredictor);
+    std::istringstream in(config_text);
+    return factory.load(in, KnobConfigFile.Value(), bps, btbs, ras, grid, error);
+}
+
+//> -threads: the state of a new thread. The globals are only used for
+//  the report (private mode) or are the shared predictors.
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    thread_state_t *ts = new thread_state_t();
+
+    if (threads_mode == THREADS_PRIVATE)
+    {
+        // Same configuration as main(), from the same text
+        string error;
+        ts->sweep = new PredictorSweep();
+        if (!CreatePredictors(ts->branch_predictors, ts->btb_predictors, ts->ras_vec, *ts->sweep, error))
+        {
+            cerr << "Error: thread " << tid << ": " << error << endl;
+            PIN_ExitApplication(1);
+        }
+        for (bp_iterator_t bp_it = ts->branch_predictors.begin(); bp_it != ts->branch_predictors.end(); ++bp_it)
+            (*bp_it)->attach(ts->context);
+    }
+    else
+    {
+        // The global RAS are never simulated, so they are still empty
+        for (ras_vec_iterator_t ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+            ts->ras_vec.push_back(new RAS(**ras_it));
+    }
+
+    PIN_GetLock(&threads_lock, tid + 1);
+    if (threads_mode == THREADS_SHARED)
+    {
+        // Same tables as branch_context, empty histories
+        ts->context = branch_context;
+        ts->context.reset();
+    }
+    thread_states.push_back(ts);
+    PIN_ReleaseLock(&threads_lock);
+
+    PIN_SetThreadData(thread_key, ts, tid);
+}
+
 VOID InitRas()
 {
-    /* Question 5.5
-    ras_vec.push_back(new RAS(4));
-    ras_vec.push_back(new RAS(8));
-    ras_vec.push_back(new RAS(16));
-    ras_vec.push_back(new RAS(32));
-    ras_vec.push_back(new RAS(48));
-    ras_vec.push_back(new RAS(64));
+    /* Question 5.5: all the depths share one stack and are simulated in a single pass
+    UINT32 depths[] = {4, 8, 16, 32, 48, 64};
+    ras_vec.push_back(new RAS(std::vector<UINT32>(depths, depths + 6)));
     */
 }
 
@@ -309,15 +1604,278 @@ int main(int argc, char *argv[])
     // Open output file
     outFile.open(KnobOutputFile.Value().c_str());
 
-    // Initialize predictors and RAS vector
-    InitPredictors();
-    // InitRas();
+    // Machine-readable copies of the results
+    if ((!KnobJsonFile.Value().empty() || !KnobRecordsFile.Value().empty()) &&
+        !results.open(KnobJsonFile.Value(), KnobRecordsFile.Value(), KnobOutputFile.Value()))
+    {
+        cerr << "Error: could not open the -json/-records files" << endl;
+        return 1;
+    }
+
+    // Open branch trace file
+    if (!KnobTraceFile.Value().empty() && !trace_writer.open(KnobTraceFile.Value()))
+    {
+        cerr << "Error: could not open trace file " << KnobTraceFile.Value() << endl;
+        return 1;
+    }
+
+    // Per-thread branch buffer, drained in batches by BufferFull()
+    if (KnobBuffered.Value())
+    {
+        if (trace_writer.isOpen())
+        {
+            cerr << "Error: -buffered cannot be combined with -trace" << endl;
+            return 1;
+        }
+        branch_buffer = PIN_DefineTraceBuffer(sizeof(branch_buffer_record_t),
+                                              KnobBufferPages.Value(), BufferFull, 0);
+        if (branch_buffer == INVALID_BUFFER_ID)
+        {
+            cerr << "Error: could not allocate the branch buffer" << endl;
+            return 1;
+        }
+    }
+
+    // Warm-up and instruction limit
+    if (KnobSkip.Value() > 0 || KnobMaxInstructions.Value() > 0)
+    {
+        if (KnobBuffered.Value())
+        {
+            cerr << "Error: -skip and -max cannot be combined with -buffered" << endl;
+            return 1;
+        }
+        if (KnobSkip.Value() > 0 && (KnobWorkers.Value() > 0 || trace_writer.isOpen()))
+        {
+            cerr << "Error: -skip cannot be combined with -workers or -trace" << endl;
+            return 1;
+        }
+        instruction_events = true;
+        warming_up = KnobSkip.Value() > 0;
+        next_limit = warming_up ? KnobSkip.Value() : KnobMaxInstructions.Value();
+    }
+    in_roi = KnobRoiBegin.Value().empty();
+
+    // Basic-block vector profile, no predictors
+    if (!KnobBbvFile.Value().empty())
+    {
+        if (KnobInterval.Value() == 0 || !bbv.open(KnobBbvFile.Value(), KnobInterval.Value()))
+        {
+            cerr << "Error: could not open BBV file " << KnobBbvFile.Value() << endl;
+            return 1;
+        }
+        simulate_branches = false;
+    }
+
+    // Initialize predictors and RAS vector, from the -config file if given
+    // (else the compile-time set of a CSLAB_STATIC_PREDICTORS build)
+    string config_error;
+#ifdef CSLAB_STATIC_PREDICTORS
+    static_predictors_on = KnobConfigFile.Value().empty();
+#endif
+    if (!KnobConfigFile.Value().empty())
+    {
+        std::ifstream config(KnobConfigFile.Value().c_str());
+        std::ostringstream text;
+        if (!config)
+        {
+            cerr << "Error: could not open " << KnobConfigFile.Value() << endl;
+            return 1;
+        }
+        text << config.rdbuf();
+        config_text = text.str();
+    }
+    if (!CreatePredictors(branch_predictors, btb_predictors, ras_vec, sweep, config_error))
+    {
+        cerr << "Error: " << config_error << endl;
+        return 1;
+    }
+
+    // Distribute the predictors round-robin over the worker threads
+    if (KnobWorkers.Value() > 0 && !KnobTraceOnly.Value())
+    {
+        UINT32 num_workers = KnobWorkers.Value();
+        size_t ring_entries = KnobRingEntries.Value();
+
+        if (ring_entries == 0 || (ring_entries & (ring_entries - 1)) != 0)
+        {
+            cerr << "Error: -ring_entries must be a power of 2" << endl;
+            return 1;
+        }
+        for (UINT32 i = 0; i < num_workers; i++)
+            workers.push_back(new worker_t(ring_entries));
+        for (size_t i = 0; i < branch_predictors.size(); i++)
+            workers[i % num_workers]->branch_predictors.push_back(branch_predictors[i]);
+        for (size_t i = 0; i < btb_predictors.size(); i++)
+            workers[i % num_workers]->btb_predictors.push_back(btb_predictors[i]);
+        for (size_t i = 0; i < ras_vec.size(); i++)
+            workers[i % num_workers]->ras_vec.push_back(ras_vec[i]);
+        workers[0]->sweep = &sweep;
+
+        for (worker_iterator_t w_it = workers.begin(); w_it != workers.end(); ++w_it)
+        {
+            if (PIN_SpawnInternalThread(WorkerThread, *w_it, 0, &(*w_it)->uid) == INVALID_THREADID)
+            {
+                cerr << "Error: could not spawn a worker thread" << endl;
+                return 1;
+            }
+        }
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    }
+
+    // Sampled simulation of the SimPoint intervals, branch by branch
+    if (!KnobSimPoints.Value().empty())
+    {
+        string error;
+        if (!sampler.load(KnobSimPoints.Value(), KnobWeights.Value(), error))
+        {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+        if (KnobInterval.Value() == 0 || bbv.isOpen() || instruction_events ||
+            branch_buffer != INVALID_BUFFER_ID || !workers.empty())
+        {
+            cerr << "Error: -simpoints needs an -interval and cannot be combined with "
+                    "-bbv, -skip, -max, -buffered or -workers" << endl;
+            return 1;
+        }
+        branch_counts(sampled.correct, sampled.incorrect);
+        size_t n = sampled.correct.size();
+        sampled.correct_rate.assign(n, 0.0);
+        sampled.incorrect_rate.assign(n, 0.0);
+        sampled.weight = 0;
+
+        // Restored checkpoints replace the warm-up
+        sampler.start(KnobInterval.Value(), KnobLoadState.Value().empty() ? KnobWarmup.Value() : 0);
+        if (sampler.getPhase() == SimPointSampler::MEASURE)
+            begin_sampled_interval();
+        simulate_branches = sampler.getPhase() != SimPointSampler::FAST_FORWARD;
+        instruction_events = true;
+        next_limit = sampler.nextEvent();
+    }
+
+    // Misprediction time series, written by an internal thread
+    if (!KnobSeriesFile.Value().empty())
+    {
+        if (KnobSeriesInterval.Value() == 0 || sampler.active() ||
+            branch_buffer != INVALID_BUFFER_ID || !workers.empty())
+        {
+            cerr << "Error: -series needs a -series_interval and cannot be combined with "
+                    "-simpoints, -buffered or -workers" << endl;
+            return 1;
+        }
+        std::vector<string> names;
+        for (bp_iterator_t bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+            names.push_back((*bp_it)->getName());
+        if (!series.open(KnobSeriesFile.Value(), KnobSeriesBinary.Value(), KnobSeriesInterval.Value(), names))
+        {
+            cerr << "Error: could not open series file " << KnobSeriesFile.Value() << endl;
+            return 1;
+        }
+        series_row.resize(names.size() + 1);
+        if (PIN_SpawnInternalThread(SeriesWriterThread, 0, 0, &series_writer_uid) == INVALID_THREADID)
+        {
+            cerr << "Error: could not spawn the series writer thread" << endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+        instruction_events = true;
+        // Rows start after the warm-up, which clears total_instructions
+        next_snapshot = warming_up ? ~0ULL : KnobSeriesInterval.Value();
+    }
+    next_event = (next_limit < next_snapshot) ? next_limit : next_snapshot;
+
+    // Per static branch mispredictions
+    if (!KnobProfileFile.Value().empty())
+    {
+        if (branch_buffer != INVALID_BUFFER_ID || !workers.empty())
+        {
+            cerr << "Error: -profile cannot be combined with -buffered or -workers" << endl;
+            return 1;
+        }
+        branch_profile.init(branch_predictors.size());
+        profile_branches = true;
+    }
+
+    // Per-thread state of multithreaded programs
+    if (!KnobThreads.Value().empty())
+    {
+        if (KnobThreads.Value() == "private")
+            threads_mode = THREADS_PRIVATE;
+        else if (KnobThreads.Value() == "shared")
+            threads_mode = THREADS_SHARED;
+        else
+        {
+            cerr << "Error: -threads must be private or shared" << endl;
+            return 1;
+        }
+        if (trace_writer.isOpen() || branch_buffer != INVALID_BUFFER_ID || !workers.empty() ||
+            instruction_events || bbv.isOpen() || profile_branches)
+        {
+            cerr << "Error: -threads cannot be combined with -trace, -buffered, -workers, -skip, -max, "
+                    "-simpoints, -bbv, -series or -profile" << endl;
+            return 1;
+        }
+        if (threads_mode == THREADS_SHARED && !sweep.empty())
+        {
+            cerr << "Error: -threads shared cannot simulate *Sweep entries, they keep their own global history" << endl;
+            return 1;
+        }
+        thread_key = PIN_CreateThreadDataKey(NULL);
+        if (thread_key == INVALID_TLS_KEY)
+        {
+            cerr << "Error: could not create the thread data key" << endl;
+            return 1;
+        }
+        PIN_InitLock(&threads_lock);
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+    }
+
+#ifdef CSLAB_STATIC_PREDICTORS
+    // The compile-time set has no per-thread copies and no per-predictor
+    // series or profile columns
+    if (static_predictors_on && (threads_mode == THREADS_PRIVATE || series.isOpen() || profile_branches))
+    {
+        cerr << "Error: -threads private, -series and -profile need a -config file in a "
+                "CSLAB_STATIC_PREDICTORS build" << endl;
+        return 1;
+    }
+#endif
+
+    // Branch by branch the predictors can share their histories
+    if (branch_buffer == INVALID_BUFFER_ID && workers.empty())
+        for (bp_iterator_t bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+            (*bp_it)->attach(branch_context);
+
+    // Predictor checkpoints, only of the predictors attached to branch_context
+    if (!KnobSaveState.Value().empty() || !KnobLoadState.Value().empty())
+    {
+        if (branch_buffer != INVALID_BUFFER_ID || !workers.empty() || threads_mode != THREADS_OFF)
+        {
+            cerr << "Error: -save_state and -load_state cannot be combined with -buffered, -workers or -threads" << endl;
+            return 1;
+        }
+        if (sampler.active() && sampler.getPhase() == SimPointSampler::MEASURE)
+            simpoint_checkpoint();
+        else if (!sampler.active() && !KnobLoadState.Value().empty())
+        {
+            string error;
+            if (!LoadState(KnobLoadState.Value(), error))
+            {
+                cerr << "Error: " << error << endl;
+                return 1;
+            }
+        }
+    }
 
     // Instrument function calls in order to catch __parsec_roi_{begin,end}
-    INS_AddInstrumentFunction(Instruction, 0);
+    // (-roi_begin, -roi_end)
+    if (!KnobRoiBegin.Value().empty() || !KnobRoiEnd.Value().empty())
+        IMG_AddInstrumentFunction(Image, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
 
     // Called when the instrumented application finishes its execution
     PIN_AddFiniFunction(Fini, 0);
+    PIN_AddDetachFunction(Detach, 0);
 
     // Never returns
     PIN_StartProgram();
@@ -3,6 +3,8 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstring> // memset()
+#include <vector>
 
 using namespace std;
 
@@ -11,6 +13,8 @@ using namespace std;
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE,    "pintool",
     "o", "cslab_branch_stats.out", "specify output file name");
+KNOB<BOOL> KnobThreads(KNOB_MODE_WRITEONCE, "pintool",
+    "threads", "0", "count per thread (Pin TLS) instead of in shared globals, for multithreaded programs");
 /* ===================================================================== */
 
 /* ===================================================================== */
@@ -27,6 +31,19 @@ struct branch_stats_s {
 UINT64 total_instructions;
 std::ofstream outFile;
 
+//> -threads: counters of one thread, merged into the globals by Fini().
+//  Padded so that the counters of two threads never share a cache line.
+struct thread_stats_s {
+    char pad0[64];
+    UINT64 instructions;
+    branch_stats_s stats;
+    char pad1[64];
+};
+
+TLS_KEY thread_key = INVALID_TLS_KEY;
+std::vector<thread_stats_s *> thread_stats;
+PIN_LOCK thread_stats_lock;
+
 /* ===================================================================== */
 
 INT32 Usage()
@@ -44,6 +61,11 @@ VOID count_instruction()
     total_instructions++;
 }
 
+VOID count_bbl_instructions(UINT32 num_ins)
+{
+    total_instructions += num_ins;
+}
+
 VOID call_instruction()
 {
     branch_stats.call++;
@@ -68,8 +90,71 @@ VOID unconditional_instruction()
     branch_stats.total++;
 }
 
+inline branch_stats_s &stats_of(THREADID tid)
+{
+    return static_cast<thread_stats_s *>(PIN_GetThreadData(thread_key, tid))->stats;
+}
+
+VOID thread_count_instruction(THREADID tid)
+{
+    static_cast<thread_stats_s *>(PIN_GetThreadData(thread_key, tid))->instructions++;
+}
+
+VOID thread_count_bbl_instructions(THREADID tid, UINT32 num_ins)
+{
+    static_cast<thread_stats_s *>(PIN_GetThreadData(thread_key, tid))->instructions += num_ins;
+}
+
+VOID thread_call_instruction(THREADID tid)
+{
+    branch_stats_s &stats = stats_of(tid);
+    stats.call++;
+    stats.total++;
+}
+
+VOID thread_ret_instruction(THREADID tid)
+{
+    branch_stats_s &stats = stats_of(tid);
+    stats.ret++;
+    stats.total++;
+}
+
+VOID thread_conditional_instruction(THREADID tid, BOOL taken)
+{
+    branch_stats_s &stats = stats_of(tid);
+    stats.conditional[taken]++;
+    stats.total++;
+}
+
+VOID thread_unconditional_instruction(THREADID tid)
+{
+    branch_stats_s &stats = stats_of(tid);
+    stats.unconditional++;
+    stats.total++;
+}
+
+VOID ThreadedInstruction(INS ins)
+{
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_conditional_instruction,
+                       IARG_THREAD_ID, IARG_BRANCH_TAKEN, IARG_END);
+    else if (INS_Category(ins) == XED_CATEGORY_UNCOND_BR)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_unconditional_instruction,
+                       IARG_THREAD_ID, IARG_END);
+    else if (INS_IsCall(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_call_instruction, IARG_THREAD_ID, IARG_END);
+    else if (INS_IsRet(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_ret_instruction, IARG_THREAD_ID, IARG_END);
+}
+
 VOID Instruction(INS ins, void * v)
 {
+    if (KnobThreads.Value())
+    {
+        ThreadedInstruction(ins);
+        return;
+    }
+
     if (INS_Category(ins) == XED_CATEGORY_COND_BR)
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)conditional_instruction,
                        IARG_BRANCH_TAKEN, IARG_END);
@@ -80,15 +165,63 @@ VOID Instruction(INS ins, void * v)
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)call_instruction, IARG_END);
     else if (INS_IsRet(ins))
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ret_instruction, IARG_END);
+}
+
+// Count each and every instruction, one call per basic block (REP
+// instructions are counted per iteration, as before)
+VOID Trace(TRACE trace, VOID * v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        UINT32 num_ins = 0;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if (INS_HasRealRep(ins) && KnobThreads.Value())
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)thread_count_instruction,
+                               IARG_THREAD_ID, IARG_END);
+            else if (INS_HasRealRep(ins))
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+            else
+                num_ins++;
+            Instruction(ins, v);
+        }
+        if (num_ins && KnobThreads.Value())
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)thread_count_bbl_instructions,
+                           IARG_THREAD_ID, IARG_UINT32, num_ins, IARG_END);
+        else if (num_ins)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_bbl_instructions,
+                           IARG_UINT32, num_ins, IARG_END);
+    }
+}
 
-    // Count each and every instruction
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    thread_stats_s *ts = new thread_stats_s;
+    memset(ts, 0, sizeof(*ts));
+
+    PIN_GetLock(&thread_stats_lock, tid + 1);
+    thread_stats.push_back(ts);
+    PIN_ReleaseLock(&thread_stats_lock);
+
+    PIN_SetThreadData(thread_key, ts, tid);
 }
 
 /* ===================================================================== */
 
 VOID Fini(int code, VOID * v)
 {
+    for (size_t i = 0; i < thread_stats.size(); i++)
+    {
+        const thread_stats_s *ts = thread_stats[i];
+        total_instructions += ts->instructions;
+        branch_stats.total += ts->stats.total;
+        branch_stats.conditional[0] += ts->stats.conditional[0];
+        branch_stats.conditional[1] += ts->stats.conditional[1];
+        branch_stats.unconditional += ts->stats.unconditional;
+        branch_stats.call += ts->stats.call;
+        branch_stats.ret += ts->stats.ret;
+    }
+
     // Report total instructions and total cycles
     outFile << "Total Instructions: " << total_instructions << "\n";
     outFile << "\n";
@@ -116,8 +249,21 @@ int main(int argc, char *argv[])
     // Open output file
     outFile.open(KnobOutputFile.Value().c_str());
 
-    // Instrument function calls in order to catch __parsec_roi_{begin,end}
-    INS_AddInstrumentFunction(Instruction, 0);
+    // Per-thread counters
+    if (KnobThreads.Value())
+    {
+        thread_key = PIN_CreateThreadDataKey(NULL);
+        if (thread_key == INVALID_TLS_KEY)
+        {
+            cerr << "Error: could not create the thread data key" << endl;
+            return 1;
+        }
+        PIN_InitLock(&thread_stats_lock);
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+    }
+
+    // Count the instructions of every basic block and classify the branches
+    TRACE_AddInstrumentFunction(Trace, 0);
 
     // Called when the instrumented application finishes its execution
     PIN_AddFiniFunction(Fini, 0);
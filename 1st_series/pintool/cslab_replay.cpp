@@ -0,0 +1,809 @@
+#include "pin_compat.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+#include "branch_predictor.h"
+#include "ras.h"
+#include "branch_trace.h"
+#include "predictor_sweep.h"
+#include "predictor_config.h"
+#include "results_output.h"
+
+/**
+ * Pin-free replay of a branch trace recorded with `cslab_branch -trace`.
+ * It drives the same predictor classes as the pintool and writes the same
+ * output file, so a new predictor configuration only needs a replay of the
+ * recorded trace instead of a full run under Pin.
+ *
+ * With -j the trace is split into chunks of consecutive branches that are
+ * replayed in parallel, each by its own copies of the predictors. Each
+ * chunk first replays the last -warmup records of the previous one, to
+ * warm the tables up, and its statistics start at its first record; the
+ * counts of the chunks are then added up. The result is an approximation
+ * of the sequential one (cold-start effects are left at each chunk
+ * boundary); -check replays sequentially too and reports the error.
+ *
+ * -save_state/-load_state checkpoint the predictor tables, see
+ * predictor_state.h: the state at the end of a replay, or the start of
+ * one. With -j they take a prefix instead of a file: -save_state writes the
+ * state at the start of chunk k to <prefix>.<k> (from a sequential pass),
+ * and a later -j run with the same trace and chunks restores chunk k from
+ * it instead of the warm-up, which gives the sequential result exactly
+ * (every predictor of the replay, the *Sweep grids included, has
+ * checkpoint support).
+ *
+ * -check_ras checks RAS::checkpoint()/restore() on the calls and returns of
+ * the trace, see check_ras_restore().
+ *
+ * Usage: cslab_replay -i <trace> [-o <output>] [-c <config>]
+ *                     [-j <chunks> [-warmup <records>] [-check]]
+ *                     [-save_state <file>] [-load_state <file>]
+ *                     [-json <file>] [-records <file>] [-check_ras]
+ **/
+
+/* ===================================================================== */
+/* Global Variables                                                      */
+/* ===================================================================== */
+std::vector<BranchPredictor *> branch_predictors;
+typedef std::vector<BranchPredictor *>::iterator bp_iterator_t;
+
+std::vector<BTBPredictor *> btb_predictors;
+typedef std::vector<BTBPredictor *>::iterator btb_iterator_t;
+
+std::vector<RAS *> ras_vec;
+typedef std::vector<RAS *>::iterator ras_vec_iterator_t;
+
+//> Grids of Nbit/FSM/Global/Local configurations (*Sweep config entries),
+//  simulated in one pass and reported with the branch predictors.
+PredictorSweep sweep;
+
+//> Global and local histories shared by the predictors that are simulated
+//  one branch at a time, see BranchContext.
+BranchContext branch_context;
+
+UINT64 total_instructions;
+std::ofstream outFile;
+
+//> -json/-records, same as in cslab_branch.
+ResultsWriter results;
+
+//> -check_ras: a copy of every RAS of ras_vec, see check_ras_restore().
+std::vector<RAS *> checked_ras;
+RASCheckpoint ras_checkpoint;
+UINT64 ras_checks = 0, ras_check_errors = 0;
+uint32_t wrong_path_seed = 1;
+
+//> One chunk of a -j replay: trace records [begin, end), after a warm-up
+//  from warmup_begin, by its own predictors. The chunk threads share
+//  nothing; their counts are merged into the globals above.
+struct chunk_t
+{
+    chunk_t() : warmup_begin(0), begin(0), end(0), first_block(0), first_record(0), instructions(0), ok(false) {}
+
+    UINT64 warmup_begin, begin, end; // record indices
+    size_t first_block;              // the block of warmup_begin
+    UINT64 first_record;             // index of its first record
+
+    // -save_state with -j: the state before record checkpoints[k - 1] goes
+    // to <checkpoint_prefix>.<k>
+    std::vector<UINT64> checkpoints;
+    string checkpoint_prefix;
+
+    std::vector<BranchPredictor *> branch_predictors;
+    std::vector<BTBPredictor *> btb_predictors;
+    std::vector<RAS *> ras_vec;
+    PredictorSweep sweep;
+    BranchContext context;
+    UINT64 instructions;
+    bool ok;
+};
+
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool replays a branch trace through various branch predictors.\n\n";
+    cerr << "  -i <file>  branch trace recorded with cslab_branch -trace\n";
+    cerr << "  -o <file>  specify output file name (default cslab_replay.out)\n";
+    cerr << "  -c <file>  predictor configuration file (default: InitPredictors())\n";
+    cerr << "  -j <n>     replay in n chunks in parallel, one thread each\n";
+    cerr << "  -warmup <n>  records of the previous chunk replayed before each chunk (default 1000000)\n";
+    cerr << "  -check     with -j, also replay sequentially and report the error\n";
+    cerr << "  -save_state <file>  write the predictor state at the end (-j: at every chunk, to <file>.<k>)\n";
+    cerr << "  -load_state <file>  start from a saved predictor state (-j: every chunk from <file>.<k>)\n";
+    cerr << "  -json <file>     also write the results as JSON lines (schema in results_output.h)\n";
+    cerr << "  -records <file>  also write the results as binary records\n";
+    cerr << "  -check_ras       check that RAS::restore() undoes wrong-path calls and returns\n";
+    cerr << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+
+//> -check_ras, before every call and return: each copy in checked_ras runs
+//  a wrong path of random length between checkpoint() and restore() and
+//  must then hold the same stack as its RAS. The wrong paths only contain
+//  what restore() undoes exactly: returns (also past the bottom of every
+//  depth), a return then a call, and with RAS_DROP calls past the top of
+//  the full stack. A RAS_WRAP call on a full stack overwrites an entry
+//  below the checkpointed top, which restore() does not recover.
+VOID check_ras_restore()
+{
+    const ADDRINT wrong_path_addr = ~(ADDRINT)0;
+
+    for (size_t p = 0; p < checked_ras.size(); p++)
+    {
+        RAS *ras = checked_ras[p];
+        wrong_path_seed ^= wrong_path_seed << 13;
+        wrong_path_seed ^= wrong_path_seed >> 17;
+        wrong_path_seed ^= wrong_path_seed << 5;
+        unsigned length = (wrong_path_seed >> 2) % 40;
+
+        ras->checkpoint(ras_checkpoint);
+        if (wrong_path_seed % 3 == 1)
+        {
+            ras->pop_addr(wrong_path_addr);
+            ras->push_addr(wrong_path_addr);
+        }
+        else if (wrong_path_seed % 3 == 2 && ras->getPolicy() == RAS_DROP)
+        {
+            for (unsigned k = 0; k < length; k++)
+                ras->push_addr(wrong_path_addr);
+        }
+        else
+        {
+            for (unsigned k = 0; k < length; k++)
+                ras->pop_addr(wrong_path_addr);
+        }
+        ras->restore(ras_checkpoint);
+
+        ras_checks++;
+        if (!ras->sameStack(*ras_vec[p]))
+            ras_check_errors++;
+    }
+}
+
+VOID call_instruction(ADDRINT ip, ADDRINT target, UINT32 ins_size)
+{
+    ras_vec_iterator_t ras_it;
+
+    if (!checked_ras.empty())
+    {
+        check_ras_restore();
+        for (size_t p = 0; p < checked_ras.size(); p++)
+            checked_ras[p]->push_addr(ip + ins_size);
+    }
+
+    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+    {
+        RAS *ras = *ras_it;
+        ras->push_addr(ip + ins_size);
+    }
+}
+
+VOID ret_instruction(ADDRINT ip, ADDRINT target)
+{
+    ras_vec_iterator_t ras_it;
+
+    if (!checked_ras.empty())
+    {
+        check_ras_restore();
+        for (size_t p = 0; p < checked_ras.size(); p++)
+            checked_ras[p]->pop_addr(target);
+    }
+
+    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+    {
+        RAS *ras = *ras_it;
+        ras->pop_addr(target);
+    }
+}
+
+VOID cond_branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken)
+{
+    bp_iterator_t bp_it;
+
+    branch_context.begin(ip);
+
+    for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+    {
+        BranchPredictor *curr_predictor = *bp_it;
+        curr_predictor->predictAndUpdate(ip, target, taken);
+    }
+    branch_context.end(taken);
+    if (!sweep.empty())
+        sweep.step(ip, taken);
+}
+
+VOID branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken)
+{
+    btb_iterator_t btb_it;
+
+    for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it)
+    {
+        BTBPredictor *curr_predictor = *btb_it;
+        curr_predictor->predictAndUpdate(ip, target, taken);
+    }
+}
+
+// Same call order as the instrumentation in cslab_branch.cpp
+VOID replay_record(const BranchRecord &rec)
+{
+    BOOL taken = (rec.flags & BR_TAKEN) != 0;
+
+    total_instructions += rec.icount_delta;
+
+    if (rec.flags & BR_COND)
+        cond_branch_instruction(rec.ip, rec.target, taken);
+    else if (rec.flags & BR_CALL)
+        call_instruction(rec.ip, rec.target, rec.size);
+    else if (rec.flags & BR_RET)
+        ret_instruction(rec.ip, rec.target);
+
+    if (rec.flags & BR_BTB)
+        branch_instruction(rec.ip, rec.target, taken);
+}
+
+//> -save_state: the tables of the predictors, BTBs, RAS and *Sweep grids
+//  and the shared histories. Predictors without checkpoint support are
+//  left out.
+bool SaveState(const string &filename, std::vector<BranchPredictor *> &bps, std::vector<BTBPredictor *> &btbs,
+               std::vector<RAS *> &ras, PredictorSweep &grid, BranchContext &context)
+{
+    PredictorStateWriter out;
+    out.begin("BranchContext");
+    context.save(out);
+    out.end();
+
+    for (size_t p = 0; p < bps.size(); p++)
+    {
+        out.begin(bps[p]->getName());
+        if (bps[p]->saveState(out))
+            out.end();
+        else
+            out.discard();
+    }
+    for (size_t p = 0; p < btbs.size(); p++)
+    {
+        out.begin(btbs[p]->getName());
+        btbs[p]->saveState(out);
+        out.end();
+    }
+    for (size_t p = 0; p < ras.size(); p++)
+    {
+        std::ostringstream name;
+        name << "RAS-" << p;
+        out.begin(name.str());
+        ras[p]->saveState(out);
+        out.end();
+    }
+    if (!grid.empty())
+    {
+        out.begin("PredictorSweep");
+        grid.save(out);
+        out.end();
+    }
+    return out.write(filename);
+}
+
+//> -load_state: restores a SaveState() file into the same configuration.
+//  Predictors missing from the file start cold, with a warning.
+bool LoadState(const string &filename, std::vector<BranchPredictor *> &bps, std::vector<BTBPredictor *> &btbs,
+               std::vector<RAS *> &ras, PredictorSweep &grid, BranchContext &context, string &error)
+{
+    PredictorStateReader in;
+    if (!in.open(filename, error))
+        return false;
+    if (!in.begin("BranchContext") || !context.load(in) || !in.end())
+    {
+        error = "the histories of " + filename + " are not those of these predictors";
+        return false;
+    }
+
+    for (size_t p = 0; p < bps.size() + btbs.size(); p++)
+    {
+        BranchPredictor *bp = (p < bps.size()) ? bps[p] : btbs[p - bps.size()];
+        if (!in.begin(bp->getName()))
+        {
+            cerr << "Warning: no state of " << bp->getName() << " in " << filename << ", it starts cold" << endl;
+            continue;
+        }
+        if (!bp->loadState(in) || !in.end())
+        {
+            error = "the state of " + bp->getName() + " in " + filename + " does not match the predictor";
+            return false;
+        }
+    }
+    for (size_t p = 0; p < ras.size(); p++)
+    {
+        std::ostringstream name;
+        name << "RAS-" << p;
+        if (!in.begin(name.str()) || !ras[p]->loadState(in) || !in.end())
+        {
+            error = "the state of " + name.str() + " in " + filename + " does not match the RAS";
+            return false;
+        }
+    }
+    if (grid.empty())
+        return true;
+    if (!in.begin("PredictorSweep"))
+        cerr << "Warning: no state of the *Sweep grids in " << filename << ", they start cold" << endl;
+    else if (!grid.load(in) || !in.end())
+    {
+        error = "the *Sweep state in " + filename + " does not match the grids";
+        return false;
+    }
+    return true;
+}
+
+//> Replay one chunk with the predictors of c, see chunk_t.
+VOID replay_chunk(chunk_t *c, const string &trace_file, const std::vector<BranchTraceBlock> *blocks)
+{
+    BranchTraceReader reader;
+    if (!reader.open(trace_file) || !reader.seek((*blocks)[c->first_block]))
+        return;
+
+    BranchRecord rec;
+    size_t next_checkpoint = 0;
+    for (UINT64 i = c->first_record; i < c->end && reader.next(rec); i++)
+    {
+        if (i < c->warmup_begin)
+            continue;
+        if (next_checkpoint < c->checkpoints.size() && i == c->checkpoints[next_checkpoint])
+        {
+            std::ostringstream file;
+            file << c->checkpoint_prefix << "." << ++next_checkpoint;
+            if (!SaveState(file.str(), c->branch_predictors, c->btb_predictors, c->ras_vec, c->sweep, c->context))
+            {
+                cerr << "Error: could not write " << file.str() << endl;
+                return;
+            }
+        }
+        if (i == c->begin)
+        {
+            // End of the warm-up, the tables and histories are kept
+            for (size_t p = 0; p < c->branch_predictors.size(); p++)
+                c->branch_predictors[p]->resetCounters();
+            for (size_t p = 0; p < c->btb_predictors.size(); p++)
+                c->btb_predictors[p]->resetCounters();
+            for (size_t p = 0; p < c->ras_vec.size(); p++)
+                c->ras_vec[p]->resetCounters();
+            c->sweep.resetCounters();
+        }
+        if (i >= c->begin)
+            c->instructions += rec.icount_delta;
+
+        // Same order as replay_record()
+        BOOL taken = (rec.flags & BR_TAKEN) != 0;
+        if (rec.flags & BR_COND)
+        {
+            c->context.begin(rec.ip);
+            for (size_t p = 0; p < c->branch_predictors.size(); p++)
+                c->branch_predictors[p]->predictAndUpdate(rec.ip, rec.target, taken);
+            c->context.end(taken);
+            if (!c->sweep.empty())
+                c->sweep.step(rec.ip, taken);
+        }
+        else if (rec.flags & BR_CALL)
+        {
+            for (size_t p = 0; p < c->ras_vec.size(); p++)
+                c->ras_vec[p]->push_addr(rec.ip + rec.size);
+        }
+        else if (rec.flags & BR_RET)
+        {
+            for (size_t p = 0; p < c->ras_vec.size(); p++)
+                c->ras_vec[p]->pop_addr(rec.target);
+        }
+
+        if (rec.flags & BR_BTB)
+            for (size_t p = 0; p < c->btb_predictors.size(); p++)
+                c->btb_predictors[p]->predictAndUpdate(rec.ip, rec.target, taken);
+    }
+    if (reader.isCorrupt())
+        return;
+    c->ok = true;
+}
+
+/* ===================================================================== */
+
+VOID Fini()
+{
+    bp_iterator_t bp_it;
+    btb_iterator_t btb_it;
+    ras_vec_iterator_t ras_it;
+
+    // Report total instructions and total cycles
+    outFile << "Total Instructions: " << total_instructions << "\n";
+    outFile << "\n";
+
+    outFile << "RAS: (Correct - Incorrect)\n";
+    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+    {
+        RAS *ras = *ras_it;
+        for (size_t i = 0; i < ras->getNumDepths(); i++)
+            outFile << ras->getNameAndStats(i) << "\n";
+    }
+    outFile << "\n";
+
+    if (!ras_vec.empty())
+    {
+        outFile << "RAS Overflows: (Name - Overflows - OverflowIncorrect - UnderflowIncorrect)\n";
+        for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it)
+        {
+            RAS *ras = *ras_it;
+            for (size_t i = 0; i < ras->getNumDepths(); i++)
+                outFile << ras->getOverflowStats(i) << "\n";
+        }
+        outFile << "\n";
+    }
+
+    outFile << "Branch Predictors: (Name - Correct - Incorrect)\n";
+    for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+    {
+        BranchPredictor *curr_predictor = *bp_it;
+        outFile << "  " << curr_predictor->getName() << ": "
+                << curr_predictor->getNumCorrectPredictions() << " "
+                << curr_predictor->getNumIncorrectPredictions() << "\n";
+        results.add(ResultsWriter::BRANCH, curr_predictor->getName(), curr_predictor->getParams(),
+                    curr_predictor->getStorageBits(), total_instructions, curr_predictor->getNumCorrectPredictions(),
+                    curr_predictor->getNumIncorrectPredictions(), RESULTS_NONE);
+    }
+    for (size_t i = 0; i < sweep.size(); i++)
+    {
+        outFile << "  " << sweep.getNameAndStats(i) << "\n";
+        results.add(ResultsWriter::BRANCH, sweep.getName(i), sweep.getParams(i), sweep.getStorageBits(i),
+                    total_instructions, sweep.getNumCorrectPredictions(i), sweep.getNumIncorrectPredictions(i),
+                    RESULTS_NONE);
+    }
+    outFile << "\n";
+
+    outFile << "BTB Predictors: (Name - Correct - Incorrect - TargetCorrect)\n";
+    for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end(); ++btb_it)
+    {
+        BTBPredictor *curr_predictor = *btb_it;
+        outFile << "  " << curr_predictor->getName() << ": "
+                << curr_predictor->getNumCorrectPredictions() << " "
+                << curr_predictor->getNumIncorrectPredictions() << " "
+                << curr_predictor->getNumCorrectTargetPredictions() << "\n";
+        results.add(ResultsWriter::BTB, curr_predictor->getName(), curr_predictor->getParams(),
+                    curr_predictor->getStorageBits(), total_instructions,
+                    curr_predictor->getNumCorrectPredictions(), curr_predictor->getNumIncorrectPredictions(),
+                    curr_predictor->getNumCorrectTargetPredictions());
+    }
+
+    outFile.close();
+    if (results.isOpen() && !results.close())
+        cerr << "Error: could not write the -json/-records results" << endl;
+}
+
+/* ===================================================================== */
+
+// Same set as InitPredictors() in cslab_branch.cpp, except for the
+// Pentium-M predictor which is only available inside the pintool.
+VOID InitPredictors(std::vector<BranchPredictor *> &branch_predictors)
+{
+    branch_predictors.push_back(new StaticAlwaysTakenPredictor());
+    branch_predictors.push_back(new StaticBTFNTPredictor());
+    branch_predictors.push_back(new FSMPredictor(3));
+
+    branch_predictors.push_back(new LocalHistoryPredictor(2048, 8, 8192, 2));
+    branch_predictors.push_back(new LocalHistoryPredictor(4096, 4, 8192, 2));
+    branch_predictors.push_back(new LocalHistoryPredictor(8192, 2, 8192, 2));
+
+    branch_predictors.push_back(new GlobalHistoryPredictor(16384, 2, 2));
+    branch_predictors.push_back(new GlobalHistoryPredictor(16384, 2, 4));
+    branch_predictors.push_back(new GlobalHistoryPredictor(8192, 4, 2));
+    branch_predictors.push_back(new GlobalHistoryPredictor(8192, 4, 4));
+
+    branch_predictors.push_back(new Alpha21264Predictor());
+
+    branch_predictors.push_back(
+        new TournamentHybridPredictor(
+            10,
+            new NbitPredictor(13, 2),
+            new GlobalHistoryPredictor(8192, 2, 2)));
+
+    branch_predictors.push_back(
+        new TournamentHybridPredictor(
+            10,
+            new GlobalHistoryPredictor(8192, 2, 2),
+            new LocalHistoryPredictor(8192, 2, 8192, 2)));
+
+    branch_predictors.push_back(
+        new TournamentHybridPredictor(
+            10,
+            new NbitPredictor(13, 2),
+            new LocalHistoryPredictor(8192, 2, 8192, 2)));
+
+    branch_predictors.push_back(
+        new TournamentHybridPredictor(
+            11,
+            new NbitPredictor(13, 2),
+            new GlobalHistoryPredictor(8192, 2, 2)));
+}
+
+VOID InitRas()
+{
+}
+
+//> The predictors and RAS of the config file if given, else of InitPredictors().
+bool CreatePredictors(const string &config_file, std::vector<BranchPredictor *> &bps,
+                      std::vector<BTBPredictor *> &btbs, std::vector<RAS *> &ras,
+                      PredictorSweep &grid, string &error)
+{
+    if (config_file.empty())
+    {
+        InitPredictors(bps);
+        InitRas();
+        return true;
+    }
+    PredictorFactory factory;
+    return factory.load(config_file, bps, btbs, ras, grid, error);
+}
+
+//> -j: split the trace, replay the chunks in parallel and merge their
+//  counts into the globals. -check: report the error against a sequential
+//  replay, on stdout. save_prefix/load_prefix: -save_state/-load_state.
+bool replay_parallel(const string &trace_file, const string &config_file, unsigned num_chunks,
+                     UINT64 warmup, bool check, const string &save_prefix, const string &load_prefix)
+{
+    BranchTraceReader reader;
+    std::vector<BranchTraceBlock> blocks;
+    if (!reader.open(trace_file) || !reader.scanBlocks(blocks))
+    {
+        cerr << "Error: could not read the blocks of " << trace_file << endl;
+        return false;
+    }
+    UINT64 num_records = 0;
+    for (size_t b = 0; b < blocks.size(); b++)
+        num_records += blocks[b].num_records;
+
+    std::vector<chunk_t *> chunks;
+    for (unsigned k = 0; k < num_chunks; k++)
+    {
+        chunk_t *c = new chunk_t();
+        c->begin = num_records * k / num_chunks;
+        c->end = num_records * (k + 1) / num_chunks;
+        c->warmup_begin = (c->begin > warmup) ? c->begin - warmup : 0;
+        while (c->first_block + 1 < blocks.size() &&
+               c->first_record + blocks[c->first_block].num_records <= c->warmup_begin)
+            c->first_record += blocks[c->first_block++].num_records;
+        chunks.push_back(c);
+    }
+
+    // Sequential reference: a single chunk without warm-up, which also
+    // writes the checkpoints
+    chunk_t *sequential = NULL;
+    if (check || !save_prefix.empty())
+    {
+        sequential = new chunk_t();
+        sequential->end = num_records;
+        if (!save_prefix.empty())
+            for (unsigned k = 1; k < num_chunks; k++)
+                sequential->checkpoints.push_back(chunks[k]->begin);
+        sequential->checkpoint_prefix = save_prefix;
+        chunks.push_back(sequential);
+    }
+
+    for (size_t k = 0; k < chunks.size(); k++)
+    {
+        string error;
+        chunk_t *c = chunks[k];
+        if (!CreatePredictors(config_file, c->branch_predictors, c->btb_predictors, c->ras_vec, c->sweep, error))
+        {
+            cerr << "Error: " << error << endl;
+            return false;
+        }
+        for (bp_iterator_t bp_it = c->branch_predictors.begin(); bp_it != c->branch_predictors.end(); ++bp_it)
+            (*bp_it)->attach(c->context);
+
+        // A restored chunk needs no warm-up
+        if (!load_prefix.empty() && k > 0 && c != sequential)
+        {
+            std::ostringstream file;
+            file << load_prefix << "." << k;
+            if (!LoadState(file.str(), c->branch_predictors, c->btb_predictors, c->ras_vec, c->sweep, c->context, error))
+            {
+                cerr << "Error: " << error << endl;
+                return false;
+            }
+            c->warmup_begin = c->begin;
+            c->first_block = 0;
+            c->first_record = 0;
+            while (c->first_block + 1 < blocks.size() &&
+                   c->first_record + blocks[c->first_block].num_records <= c->warmup_begin)
+                c->first_record += blocks[c->first_block++].num_records;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned k = 0; k < num_chunks; k++)
+        threads.push_back(std::thread(replay_chunk, chunks[k], trace_file, &blocks));
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    double parallel_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (unsigned k = 0; k < num_chunks; k++)
+    {
+        chunk_t *c = chunks[k];
+        if (!c->ok)
+        {
+            cerr << "Error: could not replay chunk " << k << " of " << trace_file << endl;
+            return false;
+        }
+        total_instructions += c->instructions;
+        for (size_t p = 0; p < branch_predictors.size(); p++)
+            branch_predictors[p]->mergeCounters(*c->branch_predictors[p]);
+        for (size_t p = 0; p < btb_predictors.size(); p++)
+            btb_predictors[p]->mergeCounters(*c->btb_predictors[p]);
+        for (size_t p = 0; p < ras_vec.size(); p++)
+            ras_vec[p]->mergeCounters(*c->ras_vec[p]);
+        sweep.mergeCounters(c->sweep);
+    }
+
+    cout << trace_file << ": " << num_records << " records in " << num_chunks << " chunks, ";
+    if (load_prefix.empty())
+        cout << "warm-up " << warmup;
+    else
+        cout << "restored from " << load_prefix << ".*";
+    cout << ", " << parallel_time << " s\n";
+    if (!sequential)
+        return true;
+
+    start = std::chrono::steady_clock::now();
+    replay_chunk(sequential, trace_file, &blocks);
+    double sequential_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!sequential->ok)
+    {
+        cerr << "Error: could not replay " << trace_file << " sequentially" << endl;
+        return false;
+    }
+    if (!check)
+        return true;
+    cout << "Sequential: " << sequential_time << " s, speedup " << sequential_time / parallel_time << "\n";
+
+    cout << "Predictor: sequential MPKI - chunked MPKI - relative error\n";
+    double kilo_instructions = total_instructions / 1000.0;
+    for (size_t p = 0; p < branch_predictors.size(); p++)
+    {
+        double reference = sequential->branch_predictors[p]->getNumIncorrectPredictions() / kilo_instructions;
+        double chunked = branch_predictors[p]->getNumIncorrectPredictions() / kilo_instructions;
+        double error = reference > 0 ? fabs(chunked - reference) / reference * 100 : 0.0;
+        cout << "  " << branch_predictors[p]->getName() << ": " << reference << " " << chunked
+             << " " << error << "%\n";
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    string trace_file, config_file, out_file = "cslab_replay.out", save_state, load_state, json_file, records_file;
+    unsigned num_chunks = 0;
+    UINT64 warmup = 1000000;
+    bool check = false, check_ras = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            trace_file = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            out_file = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            config_file = argv[++i];
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            num_chunks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-warmup") && i + 1 < argc)
+            warmup = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-check"))
+            check = true;
+        else if (!strcmp(argv[i], "-save_state") && i + 1 < argc)
+            save_state = argv[++i];
+        else if (!strcmp(argv[i], "-load_state") && i + 1 < argc)
+            load_state = argv[++i];
+        else if (!strcmp(argv[i], "-json") && i + 1 < argc)
+            json_file = argv[++i];
+        else if (!strcmp(argv[i], "-records") && i + 1 < argc)
+            records_file = argv[++i];
+        else if (!strcmp(argv[i], "-check_ras"))
+            check_ras = true;
+        else
+            return Usage();
+    }
+    if (trace_file.empty())
+        return Usage();
+    if (check_ras && num_chunks > 0)
+    {
+        cerr << "Error: -check_ras needs a sequential replay, without -j" << endl;
+        return 1;
+    }
+
+    BranchTraceReader reader;
+    if (!reader.open(trace_file))
+    {
+        cerr << "Error: could not open trace file " << trace_file << endl;
+        return 1;
+    }
+
+    // Open output file
+    outFile.open(out_file.c_str());
+
+    // Machine-readable copies of the results
+    if ((!json_file.empty() || !records_file.empty()) && !results.open(json_file, records_file, out_file))
+    {
+        cerr << "Error: could not open the -json/-records files" << endl;
+        return 1;
+    }
+
+    // Initialize predictors and RAS vector, from the config file if given
+    string error;
+    if (!CreatePredictors(config_file, branch_predictors, btb_predictors, ras_vec, sweep, error))
+    {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    // The global predictors only collect the counts of the chunks
+    if (num_chunks > 0)
+    {
+        if (!replay_parallel(trace_file, config_file, num_chunks, warmup, check, save_state, load_state))
+            return 1;
+        Fini();
+        return 0;
+    }
+
+    for (bp_iterator_t bp_it = branch_predictors.begin(); bp_it != branch_predictors.end(); ++bp_it)
+        (*bp_it)->attach(branch_context);
+
+    if (!load_state.empty() &&
+        !LoadState(load_state, branch_predictors, btb_predictors, ras_vec, sweep, branch_context, error))
+    {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    if (check_ras)
+        for (size_t p = 0; p < ras_vec.size(); p++)
+            checked_ras.push_back(new RAS(*ras_vec[p]));
+
+    BranchRecord rec;
+    while (reader.next(rec))
+        replay_record(rec);
+    if (reader.isCorrupt())
+    {
+        cerr << "Error: " << trace_file << " is truncated or corrupt" << endl;
+        return 1;
+    }
+
+    if (check_ras)
+    {
+        cout << "RAS check: " << ras_checks << " wrong paths, " << ras_check_errors << " not undone by restore()\n";
+        if (ras_check_errors > 0)
+        {
+            cerr << "Error: RAS::restore() did not undo " << ras_check_errors << " wrong paths" << endl;
+            return 1;
+        }
+    }
+
+    if (!save_state.empty() &&
+        !SaveState(save_state, branch_predictors, btb_predictors, ras_vec, sweep, branch_context))
+    {
+        cerr << "Error: could not write " << save_state << endl;
+        return 1;
+    }
+
+    Fini();
+
+    return 0;
+}
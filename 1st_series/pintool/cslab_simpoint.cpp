@@ -0,0 +1,314 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+/**
+ * Chooses the simulation points of a `cslab_branch -bbv` profile, as the
+ * SimPoint 3 tool does with its defaults:
+ *
+ *   - every basic-block vector is normalized to a sum of 1 and randomly
+ *     projected down to -dim dimensions
+ *   - k-means (k-means++ seeding, best of -tries runs) for k = 1 .. -k
+ *   - the smallest k whose BIC is at least 90% of the way from the lowest
+ *     to the highest BIC is picked
+ *   - each cluster is represented by the interval closest to its centroid,
+ *     with weight (intervals in the cluster) / (all intervals)
+ *
+ * Writes <prefix>.simpoints ("<interval> <cluster>") and <prefix>.weights
+ * ("<weight> <cluster>"), the input of `cslab_branch -simpoints -weights`.
+ *
+ * Usage: cslab_simpoint -i <bbv> -o <prefix> [-k <max k>] [-dim <dims>]
+ *                       [-tries <runs>] [-seed <n>]
+ **/
+
+typedef vector<double> point_t;
+
+int Usage()
+{
+    cerr << "This tool picks the simulation points of a basic-block vector profile.\n\n";
+    cerr << "  -i <file>    profile written by cslab_branch -bbv\n";
+    cerr << "  -o <prefix>  writes <prefix>.simpoints and <prefix>.weights\n";
+    cerr << "  -k <n>       largest number of clusters tried (default 30)\n";
+    cerr << "  -dim <n>     dimensions of the random projection (default 15)\n";
+    cerr << "  -tries <n>   k-means runs per k, the best is kept (default 5)\n";
+    cerr << "  -seed <n>    seed of the projection and of k-means (default 1)\n";
+    cerr << endl;
+    return -1;
+}
+
+//> Projection weight of (block, dimension), uniform in [-1, 1]. Computed
+//  from a hash instead of stored, block ids are not bounded.
+double projection(uint64_t block, unsigned dim, uint64_t seed)
+{
+    uint64_t x = (block * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)dim * 0xc2b2ae3d27d4eb4fULL) ^ seed;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+//> One projected point per "T:<id>:<count> ..." line.
+bool readBbv(const string &filename, unsigned dims, uint64_t seed, vector<point_t> &points)
+{
+    ifstream in(filename.c_str());
+    if (!in)
+        return false;
+
+    string line;
+    vector<pair<uint64_t, double> > blocks;
+    while (getline(in, line))
+    {
+        if (line.empty() || line[0] != 'T')
+            continue;
+
+        blocks.clear();
+        double total = 0;
+        const char *p = line.c_str() + 1;
+        while (*p == ':')
+        {
+            char *end;
+            uint64_t id = strtoull(p + 1, &end, 10);
+            if (*end != ':')
+                break;
+            double count = strtod(end + 1, &end);
+            blocks.push_back(make_pair(id, count));
+            total += count;
+            p = end;
+            while (*p == ' ')
+                p++;
+        }
+
+        point_t point(dims, 0.0);
+        for (size_t i = 0; i < blocks.size() && total > 0; i++)
+            for (unsigned d = 0; d < dims; d++)
+                point[d] += blocks[i].second / total * projection(blocks[i].first, d, seed);
+        points.push_back(point);
+    }
+    return true;
+}
+
+double distance2(const point_t &a, const point_t &b)
+{
+    double sum = 0;
+    for (size_t d = 0; d < a.size(); d++)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    return sum;
+}
+
+struct clustering_t
+{
+    vector<point_t> centers;
+    vector<unsigned> labels;
+    double distortion; // sum of the squared distances to the centers
+};
+
+//> Lloyd's k-means with k-means++ seeding.
+clustering_t kmeans(const vector<point_t> &points, unsigned k, mt19937_64 &rng)
+{
+    size_t n = points.size();
+    clustering_t c;
+    c.labels.assign(n, 0);
+
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    c.centers.push_back(points[pick(rng)]);
+    vector<double> nearest(n);
+    while (c.centers.size() < k)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            nearest[i] = distance2(points[i], c.centers[0]);
+            for (size_t j = 1; j < c.centers.size(); j++)
+                nearest[i] = min(nearest[i], distance2(points[i], c.centers[j]));
+            sum += nearest[i];
+        }
+        if (sum == 0)
+        {
+            c.centers.push_back(points[pick(rng)]);
+            continue;
+        }
+        double r = uniform_real_distribution<double>(0, sum)(rng);
+        size_t i = 0;
+        for (; i + 1 < n && (r -= nearest[i]) > 0; i++)
+            ;
+        c.centers.push_back(points[i]);
+    }
+
+    unsigned dims = points[0].size();
+    for (int iter = 0; iter < 100; iter++)
+    {
+        bool changed = false;
+        c.distortion = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            unsigned best = 0;
+            double best_d = distance2(points[i], c.centers[0]);
+            for (unsigned j = 1; j < k; j++)
+            {
+                double d = distance2(points[i], c.centers[j]);
+                if (d < best_d)
+                {
+                    best_d = d;
+                    best = j;
+                }
+            }
+            changed |= c.labels[i] != best;
+            c.labels[i] = best;
+            c.distortion += best_d;
+        }
+        if (!changed && iter > 0)
+            break;
+
+        vector<point_t> sums(k, point_t(dims, 0.0));
+        vector<size_t> sizes(k, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            sizes[c.labels[i]]++;
+            for (unsigned d = 0; d < dims; d++)
+                sums[c.labels[i]][d] += points[i][d];
+        }
+        for (unsigned j = 0; j < k; j++)
+            if (sizes[j])
+                for (unsigned d = 0; d < dims; d++)
+                    c.centers[j][d] = sums[j][d] / sizes[j];
+    }
+    return c;
+}
+
+//> Bayesian Information Criterion of a clustering, spherical Gaussians with
+//  a shared variance (Pelleg & Moore, as used by SimPoint).
+double bic(const clustering_t &c, size_t n, unsigned dims)
+{
+    unsigned k = c.centers.size();
+    vector<size_t> sizes(k, 0);
+    for (size_t i = 0; i < n; i++)
+        sizes[c.labels[i]]++;
+
+    double variance = c.distortion / ((double)dims * (n > k ? n - k : 1));
+    if (variance < 1e-12)
+        variance = 1e-12;
+
+    double log_likelihood = -(double)n * dims / 2.0 * log(2 * M_PI * variance) - dims * (double)(n - k) / 2.0;
+    for (unsigned j = 0; j < k; j++)
+        if (sizes[j])
+            log_likelihood += sizes[j] * log((double)sizes[j] / n);
+
+    double parameters = (double)k * (dims + 1);
+    return log_likelihood - parameters / 2.0 * log((double)n);
+}
+
+int main(int argc, char *argv[])
+{
+    string bbv_file, prefix;
+    unsigned max_k = 30, dims = 15, tries = 5;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            bbv_file = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            prefix = argv[++i];
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+            max_k = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-dim") && i + 1 < argc)
+            dims = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-tries") && i + 1 < argc)
+            tries = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else
+            return Usage();
+    }
+    if (bbv_file.empty() || prefix.empty() || max_k == 0 || dims == 0 || tries == 0)
+        return Usage();
+
+    vector<point_t> points;
+    if (!readBbv(bbv_file, dims, seed, points))
+    {
+        cerr << "Error: could not open BBV file " << bbv_file << endl;
+        return 1;
+    }
+    if (points.empty())
+    {
+        cerr << "Error: " << bbv_file << " has no intervals" << endl;
+        return 1;
+    }
+    size_t n = points.size();
+    if (max_k > n)
+        max_k = n;
+
+    // The best of several runs for every k
+    mt19937_64 rng(seed);
+    vector<clustering_t> results;
+    vector<double> scores;
+    for (unsigned k = 1; k <= max_k; k++)
+    {
+        clustering_t best = kmeans(points, k, rng);
+        for (unsigned t = 1; t < tries; t++)
+        {
+            clustering_t c = kmeans(points, k, rng);
+            if (c.distortion < best.distortion)
+                best = c;
+        }
+        results.push_back(best);
+        scores.push_back(bic(best, n, dims));
+    }
+
+    double lo = scores[0], hi = scores[0];
+    for (size_t i = 1; i < scores.size(); i++)
+    {
+        lo = min(lo, scores[i]);
+        hi = max(hi, scores[i]);
+    }
+    size_t chosen = 0;
+    while (chosen + 1 < scores.size() && scores[chosen] < lo + 0.9 * (hi - lo))
+        chosen++;
+    const clustering_t &c = results[chosen];
+
+    // Representative (closest to the centroid) and weight of every non-empty cluster
+    unsigned k = c.centers.size();
+    vector<size_t> sizes(k, 0), representative(k, 0);
+    vector<double> closest(k, HUGE_VAL);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned j = c.labels[i];
+        sizes[j]++;
+        double d = distance2(points[i], c.centers[j]);
+        if (d < closest[j])
+        {
+            closest[j] = d;
+            representative[j] = i;
+        }
+    }
+
+    ofstream simpoints((prefix + ".simpoints").c_str()), weights((prefix + ".weights").c_str());
+    if (!simpoints || !weights)
+    {
+        cerr << "Error: could not write " << prefix << ".simpoints/.weights" << endl;
+        return 1;
+    }
+    unsigned cluster = 0;
+    for (unsigned j = 0; j < k; j++)
+    {
+        if (!sizes[j])
+            continue;
+        simpoints << representative[j] << " " << cluster << "\n";
+        weights << (double)sizes[j] / n << " " << cluster << "\n";
+        cluster++;
+    }
+
+    cout << bbv_file << ": " << n << " intervals, k = " << cluster << " (BIC " << scores[chosen]
+         << ", range " << lo << " .. " << hi << ")\n";
+    return 0;
+}
@@ -0,0 +1,193 @@
+#ifndef HISTORY_REGISTER_H
+#define HISTORY_REGISTER_H
+
+#include <cstdint> // uint64_t
+#include <cstring> // memmove()
+#include <vector>
+#include <type_traits> // std::conditional
+
+#include "predictor_state.h"
+
+/**
+ * Branch outcome history shared by the history-based predictors.
+ *
+ * The newest outcome is bit 0 and older outcomes move towards the higher
+ * bits, so recent(k) is the history of the last k branches (1 <= k <= 64) and
+ * bit(i) the outcome of the i-th previous branch.
+ *
+ *   HistoryRegister<N>, N <= 64   a single integer of the smallest width that
+ *                                 holds N bits (e.g. one byte per local history)
+ *   HistoryRegister<N>, N > 64    the last 64 outcomes in an integer plus a
+ *   DynamicHistoryRegister        circular bit buffer for bit(), so push() is
+ *                                 O(1) for any length; the dynamic one takes
+ *                                 its length at run time
+ *
+ * FoldedHistory follows a register incrementally, so hashing a 2048-bit
+ * history into an index costs the same per branch as an 8-bit one.
+ *
+ * SignedHistory keeps the same outcomes as +1/-1 bytes, the vector operand
+ * of the perceptron.
+ **/
+template <unsigned N>
+struct HistoryWord
+{
+    typedef typename std::conditional<N <= 8, uint8_t,
+            typename std::conditional<N <= 16, uint16_t,
+            typename std::conditional<N <= 32, uint32_t, uint64_t>::type>::type>::type type;
+};
+
+// The low k bits of value, 1 <= k <= 64
+inline uint64_t lowBits(uint64_t value, unsigned k)
+{
+    return value & (~0ULL >> (64 - k));
+}
+
+template <unsigned N, bool Small = (N != 0 && N <= 64)>
+class HistoryRegister;
+
+template <unsigned N>
+class HistoryRegister<N, true>
+{
+public:
+    explicit HistoryRegister(unsigned length = N) : bits(0) {}
+
+    void push(bool taken) { bits = (bits << 1) | taken; }
+    uint64_t recent(unsigned k) const { return lowBits(bits, k); }
+    bool bit(unsigned i) const { return (bits >> i) & 1; }
+
+    void save(PredictorStateWriter &out) const { out.put(bits); }
+    bool load(PredictorStateReader &in) { return in.get(bits); }
+
+private:
+    typename HistoryWord<N>::type bits;
+};
+
+template <unsigned N>
+class HistoryRegister<N, false>
+{
+public:
+    explicit HistoryRegister(unsigned length = N) : newest(0), pos(0), bit_mask(0)
+    {
+        // Up to 64 outcomes fit in newest alone
+        if (length > 64)
+        {
+            unsigned num_words = 2;
+            while (num_words * 64 < length)
+                num_words <<= 1;
+            words.assign(num_words, 0);
+            bit_mask = num_words * 64 - 1;
+        }
+    }
+
+    void push(bool taken)
+    {
+        newest = (newest << 1) | taken;
+        if (bit_mask)
+        {
+            pos = (pos - 1) & bit_mask;
+            uint64_t &word = words[pos >> 6];
+            word = (word & ~(1ULL << (pos & 63))) | ((uint64_t)taken << (pos & 63));
+        }
+    }
+
+    uint64_t recent(unsigned k) const { return lowBits(newest, k); }
+
+    bool bit(unsigned i) const
+    {
+        if (i < 64)
+            return (newest >> i) & 1;
+        unsigned p = (pos + i) & bit_mask;
+        return (words[p >> 6] >> (p & 63)) & 1;
+    }
+
+    void save(PredictorStateWriter &out) const
+    {
+        out.put(newest);
+        out.put(words);
+        out.put(pos);
+    }
+
+    // Only into a register of the same length
+    bool load(PredictorStateReader &in) { return in.get(newest) && in.get(words) && in.get(pos); }
+
+private:
+    uint64_t newest; // the last 64 outcomes, so recent() needs no buffer access
+    std::vector<uint64_t> words;
+    unsigned pos;      // bit position of the newest outcome in words
+    unsigned bit_mask; // 0 if words is not needed
+};
+
+typedef HistoryRegister<0> DynamicHistoryRegister;
+
+//> The last length outcomes of a history register XOR-folded down to width
+//  bits, maintained incrementally (one shift and two XORs per branch) as in
+//  the CSR registers of the TAGE papers. length may exceed width by any
+//  amount; with length <= width the value is just the last length outcomes.
+struct FoldedHistory
+{
+    unsigned value, length, width, out_shift;
+
+    void init(unsigned length_, unsigned width_)
+    {
+        value = 0;
+        length = length_;
+        width = width_;
+        out_shift = width ? length % width : 0; // width 0: value stays 0
+    }
+
+    // in: the new outcome, out: the outcome that leaves the last length branches
+    void update(bool in, bool out)
+    {
+        value = (value << 1) | in;
+        value ^= (unsigned)out << out_shift;
+        value ^= value >> width;
+        value &= (1u << width) - 1;
+    }
+
+    // Call before history.push(in)
+    template <typename History>
+    void update(const History &history, bool in)
+    {
+        update(in, history.bit(length - 1));
+    }
+};
+
+//> The last length outcomes as +1 (taken) / -1 bytes, newest first from
+//  newest(); -1 before the first branch. The window slides down a buffer
+//  and is copied back to its top once every SLACK branches.
+class SignedHistory
+{
+public:
+    explicit SignedHistory(unsigned length_ = 0) : bytes(SLACK + length_, -1), pos(SLACK), length(length_) {}
+
+    void push(bool taken)
+    {
+        if (pos == 0)
+        {
+            memmove(&bytes[SLACK], &bytes[0], length);
+            pos = SLACK;
+        }
+        pos--;
+        bytes[pos] = taken ? 1 : -1;
+    }
+
+    const int8_t *newest() const { return &bytes[pos]; }
+    unsigned getLength() const { return length; }
+
+    void save(PredictorStateWriter &out) const
+    {
+        out.put(bytes);
+        out.put(pos);
+    }
+
+    // Only into a window of the same length
+    bool load(PredictorStateReader &in) { return in.get(bytes) && in.get(pos); }
+
+private:
+    static const unsigned SLACK = 1024;
+
+    std::vector<int8_t> bytes;
+    unsigned pos, length;
+};
+
+#endif
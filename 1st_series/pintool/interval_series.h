@@ -0,0 +1,129 @@
+#ifndef INTERVAL_SERIES_H
+#define INTERVAL_SERIES_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "branch_ring.h"
+
+/**
+ * Time series of the predictor counters (cslab_branch -series), one row
+ * every interval instructions. A row holds cumulative values: the
+ * instruction count, then one counter per column, so the MPKI of an
+ * interval is the difference of two rows.
+ *
+ * Rows go through a fixed-size SpscRing and are written by a flusher
+ * thread (drain()), so memory stays constant however long the run and the
+ * application thread never waits for the disk unless the ring is full.
+ *
+ * CSV: a header line "instructions,<name>,...", then one line per row.
+ * Binary: "CSLABTS1", the interval and the number of columns (UINT64
+ * each), the names, one per line, then the rows as native UINT64s.
+ **/
+class IntervalSeries
+{
+public:
+    IntervalSeries() : ring(NULL), interval(0), width(0), column(0), binary(false), stopped(false) {}
+    ~IntervalSeries() { delete ring; }
+
+    bool open(const std::string &filename, bool binary_, UINT64 interval_,
+              const std::vector<std::string> &names)
+    {
+        binary = binary_;
+        interval = interval_;
+        width = names.size() + 1;
+
+        // Room for at least 256 rows
+        size_t capacity = 1;
+        while (capacity < 256 * width)
+            capacity <<= 1;
+        ring = new SpscRing<UINT64>(capacity);
+
+        file.open(filename.c_str(), binary ? std::ios::out | std::ios::binary : std::ios::out);
+        if (!file.is_open())
+            return false;
+
+        if (binary)
+        {
+            UINT64 header[2] = {interval, names.size()};
+            file.write("CSLABTS1", 8);
+            file.write((const char *)header, sizeof(header));
+            for (size_t i = 0; i < names.size(); i++)
+                file << names[i] << "\n";
+        }
+        else
+        {
+            file << "instructions";
+            for (size_t i = 0; i < names.size(); i++)
+                file << "," << names[i];
+            file << "\n";
+        }
+        return true;
+    }
+
+    bool isOpen() const { return file.is_open(); }
+    UINT64 getInterval() const { return interval; }
+
+    // Producer: one row of 1 + names.size() values. Waits for the flusher
+    // when the ring is full, or writes the ring itself once stop() was called.
+    void push(const UINT64 *row)
+    {
+        size_t pushed = 0;
+        while ((pushed += ring->push(row + pushed, width - pushed)) < width)
+        {
+            if (stopped)
+                drain();
+            else
+                PIN_Yield();
+        }
+    }
+
+    // Consumer: writes everything in the ring, returns false if it was empty
+    bool drain()
+    {
+        const UINT64 *values;
+        size_t n, total = 0;
+        while ((n = ring->peek(values)) != 0)
+        {
+            write(values, n);
+            ring->consume(n);
+            total += n;
+        }
+        return total != 0;
+    }
+
+    // After the flusher thread has terminated
+    void stop() { stopped = true; }
+
+    void close()
+    {
+        drain();
+        file.close();
+    }
+
+private:
+    void write(const UINT64 *values, size_t n)
+    {
+        if (binary)
+        {
+            file.write((const char *)values, n * sizeof(UINT64));
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            file << values[i] << ((++column == width) ? "\n" : ",");
+            if (column == width)
+                column = 0;
+        }
+    }
+
+    SpscRing<UINT64> *ring;
+    std::ofstream file;
+    UINT64 interval;
+    size_t width, column; // column: of the next value written, CSV only
+    bool binary;
+    bool stopped;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef PACKED_COUNTERS_H
+#define PACKED_COUNTERS_H
+
+#include <cstdint> // uint64_t
+#include <cstddef> // size_t
+#include <vector>
+
+#include "predictor_state.h"
+
+/**
+ * Table of saturating counters of up to 8 bits, a byte each: by default the
+ * CounterTable of the predictors (the PHTs of the Nbit, FSM, Global and Local
+ * predictors, the Tournament chooser and the TAGE base table). A lookup is a single byte load, and a 32K-entry table
+ * takes 32 KB instead of the 256 KB of an unsigned long long per counter.
+ *
+ * counter_bench, 16 tables of 2-bit counters, in Mbranch/s:
+ *
+ *   entries    ull   CounterArray   PackedCounterArray
+ *      8K     43.2       50.1              25.3
+ *     32K     33.7       50.1              24.9
+ *    128K     15.7       42.6              22.0
+ *      1M     10.5       17.5              17.9
+ *
+ * Packing into bit lanes saves memory but not time: up to 128K entries its
+ * shift and mask cost more than the cache misses of the byte table, and it
+ * only draws level once the byte table no longer fits in the L2.
+ **/
+class CounterArray
+{
+public:
+    // counter_bits (at most 8) only matters to PackedCounterArray
+    CounterArray(size_t entries, unsigned /* counter_bits */, uint8_t initial_value = 0)
+        : counters(entries, initial_value) {}
+
+    //> One counter, located once, so that a prediction can read it and the
+    //  following update write it without recomputing the index.
+    class Slot
+    {
+    public:
+        Slot(uint8_t &counter_) : counter(&counter_) {}
+
+        uint64_t get() const { return *counter; }
+
+        void set(uint64_t value) { *counter = (uint8_t)value; }
+
+        // Saturating update towards max (taken) or 0 (not taken)
+        void update(bool increment, uint64_t max)
+        {
+            if (increment)
+            {
+                if (*counter < max)
+                    ++*counter;
+            }
+            else if (*counter > 0)
+                --*counter;
+        }
+
+    private:
+        uint8_t *counter;
+    };
+
+    Slot slot(size_t i) { return Slot(counters[i]); }
+
+    uint64_t get(size_t i) const { return counters[i]; }
+
+    void set(size_t i, uint64_t value) { counters[i] = (uint8_t)value; }
+
+    void update(size_t i, bool increment, uint64_t max) { slot(i).update(increment, max); }
+
+    size_t size() const { return counters.size(); }
+    size_t sizeBytes() const { return counters.size(); }
+
+    void save(PredictorStateWriter &out) const { out.put(counters); }
+    bool load(PredictorStateReader &in) { return in.get(counters); }
+
+private:
+    std::vector<uint8_t> counters;
+};
+
+/**
+ * Table of small saturating counters packed into 64-bit words, for
+ * comparison in counter_bench and, built with CSLAB_PACKED_COUNTERS, as the
+ * CounterTable of the predictors when byte tables would not fit in memory.
+ * Each counter gets a lane of the next power of 2 bits (1, 2, 4, 8, ... 64),
+ * so a lane never straddles two words and a lookup is one load, a shift and
+ * a mask. A 32K-entry table of 2-bit counters takes 8 KB instead of the
+ * 256 KB of an unsigned long long per counter.
+ **/
+class PackedCounterArray
+{
+public:
+    PackedCounterArray(size_t entries, unsigned counter_bits, uint64_t initial_value = 0)
+        : num_entries(entries)
+    {
+        lane_shift = 0; // log2(lane bits)
+        while ((1u << lane_shift) < counter_bits)
+            lane_shift++;
+        unsigned lane_bits = 1u << lane_shift;
+
+        lane_mask = (lane_bits == 64) ? ~0ULL : ((1ULL << lane_bits) - 1);
+        per_word_shift = 6 - lane_shift; // log2(lanes per word)
+        per_word_mask = (1u << per_word_shift) - 1;
+
+        // Replicate the initial value into every lane of a word
+        uint64_t word = 0;
+        for (unsigned lane = 0; lane < (1u << per_word_shift); lane++)
+            word |= (initial_value & lane_mask) << (lane << lane_shift);
+        words.assign((entries + per_word_mask) >> per_word_shift, word);
+    }
+
+    //> One counter, located once, so that a prediction can read it and the
+    //  following update write it without recomputing the word and shift.
+    class Slot
+    {
+    public:
+        Slot(uint64_t &word_, unsigned shift_, uint64_t mask_) : word(&word_), s(shift_), mask(mask_) {}
+
+        uint64_t get() const { return (*word >> s) & mask; }
+
+        void set(uint64_t value) { *word = (*word & ~(mask << s)) | ((value & mask) << s); }
+
+        // Saturating update towards max (taken) or 0 (not taken). The lane is
+        // incremented in place, it cannot carry into its neighbour.
+        void update(bool increment, uint64_t max)
+        {
+            uint64_t value = get();
+            if (increment)
+            {
+                if (value < max)
+                    *word += 1ULL << s;
+            }
+            else if (value > 0)
+                *word -= 1ULL << s;
+        }
+
+    private:
+        uint64_t *word;
+        unsigned s;
+        uint64_t mask;
+    };
+
+    Slot slot(size_t i) { return Slot(words[i >> per_word_shift], shift(i), lane_mask); }
+
+    uint64_t get(size_t i) const
+    {
+        return (words[i >> per_word_shift] >> shift(i)) & lane_mask;
+    }
+
+    void set(size_t i, uint64_t value) { slot(i).set(value); }
+
+    void update(size_t i, bool increment, uint64_t max) { slot(i).update(increment, max); }
+
+    size_t size() const { return num_entries; }
+    size_t sizeBytes() const { return words.size() * sizeof(uint64_t); }
+
+    void save(PredictorStateWriter &out) const { out.put(words); }
+    bool load(PredictorStateReader &in) { return in.get(words); }
+
+private:
+    unsigned shift(size_t i) const { return (unsigned)(i & per_word_mask) << lane_shift; }
+
+    std::vector<uint64_t> words;
+    size_t num_entries;
+    uint64_t lane_mask;
+    unsigned lane_shift, per_word_shift, per_word_mask;
+};
+
+//> The counter tables of the predictors. make CSLAB_PACKED_COUNTERS=1 packs
+//  them into bit lanes: 4x less memory for 2-bit counters, but slower up to
+//  128K entries (see the table above). Saved predictor states of the two
+//  layouts cannot be loaded by each other.
+#ifdef CSLAB_PACKED_COUNTERS
+typedef PackedCounterArray CounterTable;
+#else
+typedef CounterArray CounterTable;
+#endif
+
+#endif
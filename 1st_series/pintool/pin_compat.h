@@ -0,0 +1,19 @@
+#ifndef PIN_COMPAT_H
+#define PIN_COMPAT_H
+
+/**
+ * The few Pin types used by the predictor headers, so that they can also be
+ * compiled into standalone (Pin-free) tools such as cslab_replay.
+ * Never include this from a pintool, pin.H already defines them.
+ **/
+
+#include <cstdint>
+
+typedef uint64_t ADDRINT;
+typedef uint64_t UINT64;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef bool BOOL;
+typedef void VOID;
+
+#endif
@@ -0,0 +1,532 @@
+#ifndef PREDICTOR_CONFIG_H
+#define PREDICTOR_CONFIG_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cctype> // isalnum(), isdigit(), isspace()
+
+/**
+ * Predictor configuration files, so that a single build of the tool can run
+ * any set of predictors (cslab_branch -config, cslab_replay -c).
+ *
+ * One predictor, BTB or RAS per line, '#' starts a comment:
+ *
+ *   Nbit(14, 2)
+ *   FSM(3)
+ *   Global(8192, 2, 2)                 # PHT entries, counter bits, BHR bits (up to 2048, folded
+ *                                      # into the index when longer than log2(PHT entries))
+ *   Local(2048, 8, 8192, 2)            # BHT entries, history bits, PHT entries, counter bits (2)
+ *   Tournament(10, Nbit(13, 2), Global(8192, 2, 2))
+ *   TAGE(12, 4, 9, 7, 5, 130)          # base bits, tables, table bits, tag bits, min/max history
+ *   Perceptron(128, 31)                # rows, history bits
+ *   Alpha21264
+ *   StaticAlwaysTaken
+ *   BTFNT
+ *   BTB(512, 2)                        # lines, associativity (LRU)
+ *   BTB(512, 2, PLRU)                  # replacement policy: LRU, PLRU or NRU
+ *   RAS(16)                            # entries
+ *   RAS(4, 8, 16, DROP)                # several depths in one pass, overflow policy WRAP or DROP
+ *
+ * Whole grids of configurations are simulated in one pass by PredictorSweep
+ * (lo, hi ranges, all combinations; table sizes as index bits):
+ *
+ *   NbitSweep(10, 16, 1, 4)            # index bits, counter bits
+ *   FSMSweep(2, 5)                     # rows
+ *   GlobalSweep(13, 14, 2, 4, 1, 8)    # PHT index bits, counter bits, BHR bits
+ *   LocalSweep(11, 13, 2, 8, 13, 13)   # BHT index bits, history bits, PHT index bits
+ *
+ * The class names of branch_predictor.h (e.g. TournamentHybridPredictor)
+ * are accepted as well. Tournament components can be any predictor spec,
+ * including other tournaments.
+ **/
+
+struct PredictorSpec
+{
+    std::string name; // empty for numbers
+    UINT64 value;
+    std::vector<PredictorSpec> args;
+
+    bool isNumber() const { return name.empty(); }
+
+    std::string toString() const
+    {
+        std::ostringstream stream;
+        if (isNumber())
+        {
+            stream << value;
+            return stream.str();
+        }
+        stream << name;
+        if (!args.empty())
+        {
+            stream << "(";
+            for (size_t i = 0; i < args.size(); i++)
+                stream << (i ? ", " : "") << args[i].toString();
+            stream << ")";
+        }
+        return stream.str();
+    }
+};
+
+//> Recursive descent parser for a single spec, e.g. "Tournament(10, Nbit(13,2), FSM(3))".
+class PredictorSpecParser
+{
+public:
+    PredictorSpecParser(const std::string &text_) : text(text_), pos(0) {}
+
+    bool parse(PredictorSpec &spec, std::string &error)
+    {
+        if (!parseSpec(spec, error))
+            return false;
+        skipSpaces();
+        if (pos != text.size())
+        {
+            error = "unexpected '" + text.substr(pos) + "'";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void skipSpaces()
+    {
+        while (pos < text.size() && isspace((unsigned char)text[pos]))
+            pos++;
+    }
+
+    bool parseSpec(PredictorSpec &spec, std::string &error)
+    {
+        skipSpaces();
+        spec.name.clear();
+        spec.value = 0;
+        spec.args.clear();
+
+        // Arguments are unsigned 32-bit, the factory casts them
+        if (pos + 1 < text.size() && text[pos] == '-' && isdigit((unsigned char)text[pos + 1]))
+        {
+            error = "negative number at '" + text.substr(pos) + "'";
+            return false;
+        }
+        if (pos < text.size() && isdigit((unsigned char)text[pos]))
+        {
+            size_t begin = pos;
+            while (pos < text.size() && isdigit((unsigned char)text[pos]))
+            {
+                spec.value = spec.value * 10 + (text[pos++] - '0');
+                if (spec.value > 0xffffffffULL)
+                {
+                    error = "number too large at '" + text.substr(begin) + "'";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        while (pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '_' || text[pos] == '-'))
+            spec.name += text[pos++];
+        if (spec.name.empty())
+        {
+            error = "expected a predictor name or a number at '" + text.substr(pos) + "'";
+            return false;
+        }
+
+        skipSpaces();
+        if (pos == text.size() || text[pos] != '(')
+            return true;
+        pos++;
+
+        while (true)
+        {
+            spec.args.push_back(PredictorSpec());
+            if (!parseSpec(spec.args.back(), error))
+                return false;
+            skipSpaces();
+            if (pos < text.size() && text[pos] == ',')
+                pos++;
+            else if (pos < text.size() && text[pos] == ')')
+            {
+                pos++;
+                return true;
+            }
+            else
+            {
+                error = "expected ',' or ')' in " + spec.name + "(...)";
+                return false;
+            }
+        }
+    }
+
+    const std::string &text;
+    size_t pos;
+};
+
+//> Optional hook for predictors that are only available in some tools
+//  (e.g. the Pentium-M predictor in the pintool). Returns NULL if unknown.
+typedef BranchPredictor *(*extra_predictor_factory_t)(const PredictorSpec &spec);
+
+class PredictorFactory
+{
+public:
+    PredictorFactory(extra_predictor_factory_t extra_ = NULL) : extra(extra_) {}
+
+    BranchPredictor *createBranchPredictor(const PredictorSpec &spec, std::string &error)
+    {
+        const std::string &n = spec.name;
+
+        if (is(n, "Nbit", "NbitPredictor") && numbers(spec, 2, error) &&
+            within(spec, 0, 1, 30, "index bits", error) && counterBits(spec, 1, error))
+            return new NbitPredictor(arg(spec, 0), arg(spec, 1));
+        if (is(n, "FSM", "FSMPredictor") && numbers(spec, 1, error))
+        {
+            if (arg(spec, 0) < 2 || arg(spec, 0) > 5)
+            {
+                error = "FSM row must be between 2 and 5";
+                return NULL;
+            }
+            return new FSMPredictor(arg(spec, 0));
+        }
+        if (is(n, "Global", "GlobalHistoryPredictor") && numbers(spec, 3, error) &&
+            powerOf2(spec, 0, "PHT entries", error) && counterBits(spec, 1, error))
+        {
+            if (arg(spec, 2) < 1 || arg(spec, 2) > 2048)
+            {
+                error = "Global BHR bits must be between 1 and 2048";
+                return NULL;
+            }
+            return new GlobalHistoryPredictor(arg(spec, 0), arg(spec, 1), arg(spec, 2));
+        }
+        if (is(n, "Local", "LocalHistoryPredictor") && numbers(spec, 4, error) &&
+            powerOf2(spec, 2, "PHT entries", error))
+        {
+            if (arg(spec, 0) < 1)
+            {
+                error = "Local BHT needs at least 1 entry";
+                return NULL;
+            }
+            if (arg(spec, 1) < 1 || arg(spec, 1) > 16)
+            {
+                error = "Local history bits must be between 1 and 16";
+                return NULL;
+            }
+            if (arg(spec, 3) != 2)
+            {
+                error = "Local PHT counters are 2 bits, counter bits must be 2";
+                return NULL;
+            }
+            return new LocalHistoryPredictor(arg(spec, 0), arg(spec, 1), arg(spec, 2), arg(spec, 3));
+        }
+        if (is(n, "Alpha21264", "Alpha21264Predictor") && numbers(spec, 0, error))
+            return new Alpha21264Predictor();
+        if (is(n, "StaticAlwaysTaken", "StaticAlwaysTakenPredictor") && numbers(spec, 0, error))
+            return new StaticAlwaysTakenPredictor();
+        if (is(n, "BTFNT", "StaticBTFNTPredictor") && numbers(spec, 0, error))
+            return new StaticBTFNTPredictor();
+        if (is(n, "TAGE", "TagePredictor") && numbers(spec, 6, error))
+        {
+            if (arg(spec, 0) < 1 || arg(spec, 0) > 24 || arg(spec, 2) < 1 || arg(spec, 2) > 20)
+                error = "TAGE base / table index bits must be between 1 and 24 / 20";
+            else if (arg(spec, 1) < 1 || arg(spec, 1) > 16)
+                error = "TAGE must have between 1 and 16 tagged tables";
+            else if (arg(spec, 3) < 2 || arg(spec, 3) > 16)
+                error = "TAGE tag bits must be between 2 and 16";
+            else if (arg(spec, 4) < 1 || arg(spec, 4) > arg(spec, 5) || arg(spec, 5) > 2048)
+                error = "TAGE history lengths must satisfy 1 <= min <= max <= 2048";
+            if (!error.empty())
+                return NULL;
+            return new TagePredictor(arg(spec, 0), arg(spec, 1), arg(spec, 2),
+                                     arg(spec, 3), arg(spec, 4), arg(spec, 5));
+        }
+        if (is(n, "Perceptron", "PerceptronPredictor") && numbers(spec, 2, error))
+        {
+            if (arg(spec, 0) < 1 || arg(spec, 1) < 1 || arg(spec, 1) > 1024)
+            {
+                error = "Perceptron needs at least 1 row and 1 to 1024 history bits";
+                return NULL;
+            }
+            return new PerceptronPredictor(arg(spec, 0), arg(spec, 1));
+        }
+        if (is(n, "Tournament", "TournamentHybridPredictor"))
+        {
+            if (spec.args.size() != 3 || !spec.args[0].isNumber() ||
+                spec.args[1].isNumber() || spec.args[2].isNumber())
+            {
+                error = "expected Tournament(index_bits, predictor, predictor)";
+                return NULL;
+            }
+            if (!within(spec, 0, 1, 30, "index bits", error))
+                return NULL;
+            BranchPredictor *p1 = createBranchPredictor(spec.args[1], error);
+            if (!p1)
+                return NULL;
+            BranchPredictor *p2 = createBranchPredictor(spec.args[2], error);
+            if (!p2)
+            {
+                delete p1;
+                return NULL;
+            }
+            return new TournamentHybridPredictor(arg(spec, 0), p1, p2);
+        }
+
+        if (error.empty() && extra)
+        {
+            BranchPredictor *bp = extra(spec);
+            if (bp)
+                return bp;
+        }
+        if (error.empty())
+            error = "unknown predictor '" + spec.toString() + "'";
+        return NULL;
+    }
+
+    // Reads a configuration file. On failure error holds "<file>:<line>: <message>".
+    bool load(const std::string &filename, std::vector<BranchPredictor *> &branch_predictors,
+              std::vector<BTBPredictor *> &btb_predictors, std::vector<RAS *> &ras_vec,
+              PredictorSweep &sweep, std::string &error)
+    {
+        std::ifstream in(filename.c_str());
+        if (!in)
+        {
+            error = "could not open " + filename;
+            return false;
+        }
+        return load(in, filename, branch_predictors, btb_predictors, ras_vec, sweep, error);
+    }
+
+    // Same, from a configuration already read; filename is for the messages
+    bool load(std::istream &in, const std::string &filename, std::vector<BranchPredictor *> &branch_predictors,
+              std::vector<BTBPredictor *> &btb_predictors, std::vector<RAS *> &ras_vec,
+              PredictorSweep &sweep, std::string &error)
+    {
+        std::string line;
+        unsigned line_no = 0;
+
+        while (std::getline(in, line))
+        {
+            line_no++;
+            size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            PredictorSpec spec;
+            PredictorSpecParser parser(line);
+            if (parser.parse(spec, error) && add(spec, branch_predictors, btb_predictors, ras_vec, sweep, error))
+                continue;
+
+            std::ostringstream stream;
+            stream << filename << ":" << line_no << ": " << error;
+            error = stream.str();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool add(const PredictorSpec &spec, std::vector<BranchPredictor *> &branch_predictors,
+             std::vector<BTBPredictor *> &btb_predictors, std::vector<RAS *> &ras_vec,
+             PredictorSweep &sweep, std::string &error)
+    {
+        if (spec.isNumber())
+        {
+            error = "expected a predictor, got a number";
+            return false;
+        }
+        if (spec.name == "NbitSweep" || spec.name == "FSMSweep" ||
+            spec.name == "GlobalSweep" || spec.name == "LocalSweep")
+            return addSweep(spec, sweep, error);
+        if (is(spec.name, "BTB", "BTBPredictor"))
+        {
+            BTBReplacementPolicy policy = BTB_LRU;
+            if (spec.args.size() == 3 && !spec.args[2].isNumber() && spec.args[2].args.empty())
+            {
+                const std::string &p = spec.args[2].name;
+                if (p == "PLRU")
+                    policy = BTB_PLRU;
+                else if (p == "NRU")
+                    policy = BTB_NRU;
+                else if (p != "LRU")
+                {
+                    error = "BTB replacement policy must be LRU, PLRU or NRU";
+                    return false;
+                }
+                PredictorSpec sizes = spec;
+                sizes.args.pop_back();
+                if (!numbers(sizes, 2, error))
+                    return false;
+            }
+            else if (!numbers(spec, 2, error))
+                return false;
+
+            unsigned assoc = arg(spec, 1);
+            unsigned sets = assoc ? arg(spec, 0) / assoc : 0;
+            if (sets == 0 || (sets & (sets - 1)) != 0 || sets * assoc != arg(spec, 0))
+            {
+                error = "BTB lines / associativity must be a power of 2";
+                return false;
+            }
+            if (assoc > 64)
+            {
+                error = "BTB associativity must be at most 64";
+                return false;
+            }
+            if (policy == BTB_PLRU && (assoc & (assoc - 1)) != 0)
+            {
+                error = "PLRU needs a power of 2 associativity";
+                return false;
+            }
+            btb_predictors.push_back(new BTBPredictor(arg(spec, 0), assoc, policy));
+            return true;
+        }
+        if (spec.name == "RAS")
+        {
+            RASOverflowPolicy policy = RAS_WRAP;
+            PredictorSpec depths = spec;
+            if (!depths.args.empty() && !depths.args.back().isNumber() && depths.args.back().args.empty())
+            {
+                const std::string &p = depths.args.back().name;
+                if (p == "DROP")
+                    policy = RAS_DROP;
+                else if (p != "WRAP")
+                {
+                    error = "RAS overflow policy must be WRAP or DROP";
+                    return false;
+                }
+                depths.args.pop_back();
+            }
+            if (depths.args.empty() || !numbers(depths, depths.args.size(), error))
+            {
+                if (error.empty())
+                    error = "RAS expects at least one depth";
+                return false;
+            }
+
+            std::vector<UINT32> entries;
+            for (size_t i = 0; i < depths.args.size(); i++)
+                entries.push_back(arg(depths, i));
+            ras_vec.push_back(new RAS(entries, policy));
+            return true;
+        }
+
+        BranchPredictor *bp = createBranchPredictor(spec, error);
+        if (!bp)
+            return false;
+        branch_predictors.push_back(bp);
+        return true;
+    }
+
+    // Adds every configuration of the [lo, hi] ranges of a *Sweep spec.
+    bool addSweep(const PredictorSpec &spec, PredictorSweep &sweep, std::string &error)
+    {
+        if (spec.name == "NbitSweep")
+        {
+            if (!numbers(spec, 4, error) || !range(spec, 0, 1, 24, "index bits", error) ||
+                !range(spec, 2, 1, 8, "counter bits", error))
+                return false;
+            for (unsigned index_bits = arg(spec, 0); index_bits <= arg(spec, 1); index_bits++)
+                for (unsigned cntr_bits = arg(spec, 2); cntr_bits <= arg(spec, 3); cntr_bits++)
+                    sweep.addNbit(index_bits, cntr_bits);
+        }
+        else if (spec.name == "FSMSweep")
+        {
+            if (!numbers(spec, 2, error) || !range(spec, 0, 2, 5, "row", error))
+                return false;
+            for (unsigned row = arg(spec, 0); row <= arg(spec, 1); row++)
+                sweep.addFSM(row);
+        }
+        else if (spec.name == "GlobalSweep")
+        {
+            if (!numbers(spec, 6, error) || !range(spec, 0, 1, 24, "PHT index bits", error) ||
+                !range(spec, 2, 1, 8, "counter bits", error) || !range(spec, 4, 1, 2048, "BHR bits", error))
+                return false;
+            for (unsigned index_bits = arg(spec, 0); index_bits <= arg(spec, 1); index_bits++)
+                for (unsigned cntr_bits = arg(spec, 2); cntr_bits <= arg(spec, 3); cntr_bits++)
+                    for (unsigned bhr_length = arg(spec, 4); bhr_length <= arg(spec, 5); bhr_length++)
+                        sweep.addGlobal(index_bits, cntr_bits, bhr_length);
+        }
+        else
+        {
+            if (!numbers(spec, 6, error) || !range(spec, 0, 1, 20, "BHT index bits", error) ||
+                !range(spec, 2, 1, 16, "history bits", error) || !range(spec, 4, 1, 24, "PHT index bits", error))
+                return false;
+            for (unsigned bht_bits = arg(spec, 0); bht_bits <= arg(spec, 1); bht_bits++)
+                for (unsigned history_length = arg(spec, 2); history_length <= arg(spec, 3); history_length++)
+                    for (unsigned pht_bits = arg(spec, 4); pht_bits <= arg(spec, 5); pht_bits++)
+                        sweep.addLocal(bht_bits, history_length, pht_bits);
+        }
+        return true;
+    }
+
+    static bool is(const std::string &name, const char *short_name, const char *class_name)
+    {
+        return name == short_name || name == class_name;
+    }
+
+    static unsigned arg(const PredictorSpec &spec, size_t i) { return (unsigned)spec.args[i].value; }
+
+    // Checks that spec has exactly n numeric arguments.
+    static bool numbers(const PredictorSpec &spec, size_t n, std::string &error)
+    {
+        bool ok = spec.args.size() == n;
+        for (size_t i = 0; ok && i < n; i++)
+            ok = spec.args[i].isNumber();
+        if (!ok)
+        {
+            std::ostringstream stream;
+            stream << spec.name << " expects " << n << " numeric argument" << (n == 1 ? "" : "s");
+            error = stream.str();
+        }
+        return ok;
+    }
+
+    // Checks that arguments i and i + 1 are a range lo <= hi within [min, max].
+    static bool range(const PredictorSpec &spec, size_t i, unsigned min, unsigned max,
+                      const char *what, std::string &error)
+    {
+        if (min <= arg(spec, i) && arg(spec, i) <= arg(spec, i + 1) && arg(spec, i + 1) <= max)
+            return true;
+        std::ostringstream stream;
+        stream << spec.name << ": " << what << " must be a range lo, hi within " << min << "-" << max;
+        error = stream.str();
+        return false;
+    }
+
+    // Checks that argument i is within [min, max].
+    static bool within(const PredictorSpec &spec, size_t i, unsigned min, unsigned max,
+                       const char *what, std::string &error)
+    {
+        if (min <= arg(spec, i) && arg(spec, i) <= max)
+            return true;
+        std::ostringstream stream;
+        stream << spec.name << ": " << what << " must be between " << min << " and " << max;
+        error = stream.str();
+        return false;
+    }
+
+    // Checks that argument i fits the counter tables (CounterTable), whose
+    // counters are at most 8 bits; wider ones would be truncated.
+    static bool counterBits(const PredictorSpec &spec, size_t i, std::string &error)
+    {
+        if (1 <= arg(spec, i) && arg(spec, i) <= 8)
+            return true;
+        std::ostringstream stream;
+        stream << spec.name << ": " << arg(spec, i) << " counter bits, the counter tables hold 1 to 8 bits per counter";
+        error = stream.str();
+        return false;
+    }
+
+    static bool powerOf2(const PredictorSpec &spec, size_t i, const char *what, std::string &error)
+    {
+        unsigned v = arg(spec, i);
+        if (v != 0 && (v & (v - 1)) == 0)
+            return true;
+        error = spec.name + ": " + what + " must be a power of 2";
+        return false;
+    }
+
+    extra_predictor_factory_t extra;
+};
+
+#endif
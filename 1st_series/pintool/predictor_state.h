@@ -0,0 +1,243 @@
+#ifndef PREDICTOR_STATE_H
+#define PREDICTOR_STATE_H
+
+#include <cstdint> // uint64_t
+#include <cstdio>  // FILE, fopen(), fwrite()
+#include <cstring> // memcpy(), memcmp()
+#include <string>
+#include <vector>
+#include <type_traits> // std::is_integral, std::is_trivially_copyable
+
+#include <fcntl.h>    // open()
+#include <unistd.h>   // close()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+
+/**
+ * Checkpoint of the predictor tables (PHT, BHT, BHR, BTB ...), for runs
+ * that start warm instead of cold: cslab_branch -save_state/-load_state and
+ * cslab_replay -save_state/-load_state. Pin independent, so that it can be
+ * used by both. Only the tables are saved, not the statistics.
+ *
+ * File layout, native byte order:
+ *   8-byte header: "CSLBST" + 2-byte format version
+ *   sections of:   [uint64 name_bytes][uint64 payload_bytes][name][payload]
+ *
+ * One section per predictor (BranchPredictor::saveState()), named after
+ * it, plus the shared histories (BranchContext) and the RAS. The name is
+ * padded to 8 bytes and every value of the payload is 8-byte aligned: an
+ * integer is stored as a uint64, an array as its length then its raw
+ * elements. Loading matches the sections by name and the arrays by length,
+ * so a table is only restored into a predictor of the same geometry.
+ *
+ * The reader maps the file instead of reading it: restoring a table is a
+ * single memcpy() from the mapping.
+ **/
+
+static const char PREDICTOR_STATE_MAGIC[6] = {'C', 'S', 'L', 'B', 'S', 'T'};
+static const uint16_t PREDICTOR_STATE_VERSION = 1;
+
+class PredictorStateWriter
+{
+public:
+    PredictorStateWriter() : section(0)
+    {
+        buffer.insert(buffer.end(), PREDICTOR_STATE_MAGIC, PREDICTOR_STATE_MAGIC + sizeof(PREDICTOR_STATE_MAGIC));
+        append(&PREDICTOR_STATE_VERSION, sizeof(PREDICTOR_STATE_VERSION));
+    }
+
+    void begin(const std::string &name)
+    {
+        section = buffer.size();
+        put(name.size());
+        put(0);
+        append(name.data(), name.size());
+    }
+
+    // Closes the section opened by begin(), discard() drops it instead
+    void end()
+    {
+        uint64_t payload_bytes = buffer.size() - section - 16 - padded(get(section));
+        memcpy(&buffer[section + 8], &payload_bytes, sizeof(payload_bytes));
+    }
+
+    void discard() { buffer.resize(section); }
+
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_integral<T>::value, "an integer");
+        uint64_t v = value;
+        append(&v, sizeof(v));
+    }
+
+    template <typename T>
+    void put(const std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "raw elements");
+        put(values.size());
+        append(values.data(), values.size() * sizeof(T));
+    }
+
+    bool write(const std::string &filename)
+    {
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (!fp)
+            return false;
+        bool ok = fwrite(&buffer[0], 1, buffer.size(), fp) == buffer.size();
+        return (fclose(fp) == 0) && ok;
+    }
+
+private:
+    static size_t padded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+
+    uint64_t get(size_t offset) const
+    {
+        uint64_t v;
+        memcpy(&v, &buffer[offset], sizeof(v));
+        return v;
+    }
+
+    // Appends bytes, zero-padded to a multiple of 8
+    void append(const void *data, size_t bytes)
+    {
+        const char *p = (const char *)data;
+        buffer.insert(buffer.end(), p, p + bytes);
+        buffer.resize(padded(buffer.size()), 0);
+    }
+
+    std::vector<char> buffer;
+    size_t section; // offset of the section being written
+};
+
+class PredictorStateReader
+{
+public:
+    PredictorStateReader() : base(NULL), length(0), pos(0), section_end(0), ok(false) {}
+    ~PredictorStateReader()
+    {
+        if (base)
+            munmap(base, length);
+    }
+
+    // Maps the file and lists its sections. error: why it failed.
+    bool open(const std::string &filename, std::string &error)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = "could not open state file " + filename;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= 8)
+        {
+            length = st.st_size;
+            base = (char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED)
+                base = NULL;
+        }
+        close(fd);
+
+        uint16_t version = 0;
+        if (base)
+            memcpy(&version, base + sizeof(PREDICTOR_STATE_MAGIC), sizeof(version));
+        if (!base || memcmp(base, PREDICTOR_STATE_MAGIC, sizeof(PREDICTOR_STATE_MAGIC)) != 0 ||
+            version != PREDICTOR_STATE_VERSION)
+        {
+            error = filename + " is not a predictor state file of version 1";
+            return false;
+        }
+
+        for (size_t offset = 8; offset < length;)
+        {
+            uint64_t name_bytes, payload_bytes;
+            if (length - offset < 16)
+                break;
+            memcpy(&name_bytes, base + offset, 8);
+            memcpy(&payload_bytes, base + offset + 8, 8);
+            size_t begin = offset + 16 + padded(name_bytes);
+            if (name_bytes > length || payload_bytes > length || begin + payload_bytes > length)
+                break;
+
+            section_t s = {std::string(base + offset + 16, name_bytes), begin, begin + payload_bytes, false};
+            sections.push_back(s);
+            offset = s.end;
+        }
+        if (sections.empty() || sections.back().end != length)
+        {
+            error = filename + " is truncated";
+            return false;
+        }
+        return true;
+    }
+
+    // Moves to the payload of the first section called name that was not
+    // read yet. False if there is none.
+    bool begin(const std::string &name)
+    {
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            if (sections[i].used || sections[i].name != name)
+                continue;
+            sections[i].used = true;
+            pos = sections[i].begin;
+            section_end = sections[i].end;
+            ok = true;
+            return true;
+        }
+        return false;
+    }
+
+    // True if every get() of the section succeeded and read it to the end
+    bool end() const { return ok && pos == section_end; }
+
+    template <typename T>
+    bool get(T &value)
+    {
+        static_assert(std::is_integral<T>::value, "an integer");
+        uint64_t v;
+        if (!read(&v, sizeof(v)))
+            return false;
+        value = (T)v;
+        return true;
+    }
+
+    // The array must have the saved length already
+    template <typename T>
+    bool get(std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "raw elements");
+        uint64_t n;
+        if (!get(n) || n != values.size())
+            return ok = false;
+        return read(values.data(), n * sizeof(T));
+    }
+
+private:
+    struct section_t
+    {
+        std::string name;
+        size_t begin, end; // payload
+        bool used;
+    };
+
+    static size_t padded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+
+    bool read(void *data, size_t bytes)
+    {
+        if (!ok || section_end - pos < padded(bytes))
+            return ok = false;
+        memcpy(data, base + pos, bytes);
+        pos += padded(bytes);
+        return true;
+    }
+
+    char *base; // the mapped file
+    size_t length;
+    std::vector<section_t> sections;
+    size_t pos, section_end; // in the current section
+    bool ok;
+};
+
+#endif
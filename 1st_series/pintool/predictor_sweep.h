@@ -0,0 +1,386 @@
+#ifndef PREDICTOR_SWEEP_H
+#define PREDICTOR_SWEEP_H
+
+#include <sstream> // std::ostringstream
+#include <string>
+#include <vector>
+#include <algorithm> // std::fill
+#include <cstring>   // memcpy()
+#include <cstdint>
+
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "history_register.h"
+
+/**
+ * Simulates a grid of Nbit, FSM, Global and Local configurations in one
+ * pass, e.g. all the (index bits, counter bits) pairs of question 5.3.
+ * Results and names are identical to separate NbitPredictor, FSMPredictor,
+ * GlobalHistoryPredictor and LocalHistoryPredictor objects.
+ *
+ * Configurations with the same index (same PC bits, or same PC bits and
+ * history) form a group. A group has one table whose rows hold one byte
+ * lane per configuration, so the index is computed and the row is loaded
+ * once per group; with SSE4.1 all the lanes of a row are predicted and
+ * updated with a few instructions (saturating adds for counters, a byte
+ * shuffle for the FSM rows). The global history and the local BHTs are
+ * shared by every group that reads them.
+ *
+ * All configurations must be added before the first step().
+ **/
+class PredictorSweep
+{
+public:
+    PredictorSweep() : steps(0), pending_steps(0), global_history(0), max_global_history(0)
+    {
+        // FSM next states of all the rows, indexed by (row - 2) * 4 + state
+        for (unsigned t = 0; t < 2; t++)
+            for (unsigned i = 0; i < 16; i++)
+                fsm_next[t][i] = FSMPredictor::transitions[i / 4][t][i % 4];
+    }
+
+    // Same parameters as NbitPredictor; counters of up to 8 bits
+    void addNbit(unsigned index_bits, unsigned cntr_bits)
+    {
+        NbitPredictor p(index_bits, cntr_bits);
+        unsigned char max = (1u << cntr_bits) - 1;
+        addLane(findGroup(SRC_PC, index_bits, 0, 0), p, 0, max, 1u << (cntr_bits - 1), false, 0);
+    }
+
+    // Same as FSMPredictor(row), 2^14 entries
+    void addFSM(unsigned row)
+    {
+        FSMPredictor p(row);
+        addLane(findGroup(SRC_PC, 14, 0, 0), p, 0, 3, 2, true, (row - 2) * 4);
+    }
+
+    // Same as GlobalHistoryPredictor(2^index_bits, cntr_bits, bhr_length)
+    void addGlobal(unsigned index_bits, unsigned cntr_bits, unsigned bhr_length)
+    {
+        GlobalHistoryPredictor p(1u << index_bits, cntr_bits, bhr_length);
+        unsigned char max = (1u << cntr_bits) - 1;
+        addLane(findGroup(SRC_GLOBAL, index_bits, bhr_length, 0), p, 1, max, 1u << (cntr_bits - 1), false, 0);
+
+        if (bhr_length > max_global_history)
+        {
+            max_global_history = bhr_length;
+            global_history = DynamicHistoryRegister(bhr_length);
+        }
+    }
+
+    // Same as LocalHistoryPredictor(2^bht_bits, history_length, 2^pht_bits, 2)
+    void addLocal(unsigned bht_bits, unsigned history_length, unsigned pht_bits)
+    {
+        LocalHistoryPredictor p(1u << bht_bits, history_length, 1u << pht_bits, 2);
+
+        size_t bht = 0;
+        while (bht < bhts.size() && bhts[bht].size() != (1u << bht_bits))
+            bht++;
+        if (bht == bhts.size())
+            bhts.push_back(std::vector<HistoryRegister<16>>(1u << bht_bits));
+
+        addLane(findGroup(SRC_LOCAL, pht_bits, history_length, bht), p, 1, 3, 2, false, 0);
+    }
+
+    void step(ADDRINT ip, bool taken)
+    {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            group_t &g = groups[i];
+            updateRow(g, &g.table[(size_t)index(g, ip) * g.stride], taken);
+        }
+
+        // The histories change only after every group has used them
+        for (size_t i = 0; i < bhts.size(); i++)
+            bhts[i][ip & (bhts[i].size() - 1)].push(taken);
+        for (size_t i = 0; i < groups.size(); i++)
+            if (groups[i].folded_history)
+                groups[i].folded.update(global_history, taken);
+        global_history.push(taken);
+
+        steps++;
+        if (++pending_steps == 255)
+            flush();
+    }
+
+    // Clears the statistics, the tables and histories are kept
+    void resetCounters()
+    {
+        flush();
+        steps = 0;
+        for (size_t i = 0; i < groups.size(); i++)
+            std::fill(groups[i].misses.begin(), groups[i].misses.end(), 0);
+    }
+
+    // Adds the statistics of an identical sweep, e.g. the copy of another thread
+    void mergeCounters(PredictorSweep &other)
+    {
+        flush();
+        other.flush();
+        steps += other.steps;
+        for (size_t i = 0; i < groups.size(); i++)
+            for (unsigned lane = 0; lane < groups[i].lanes; lane++)
+                groups[i].misses[lane] += other.groups[i].misses[lane];
+    }
+
+    size_t size() const { return points.size(); }
+    bool empty() const { return points.empty(); }
+
+    string getNameAndStats(size_t i)
+    {
+        flush();
+        const point_t &p = points[i];
+        UINT64 incorrect = groups[p.group].misses[p.lane];
+        std::ostringstream stream;
+        stream << p.name << ": " << (steps - incorrect) << " " << incorrect;
+        return stream.str();
+    }
+
+    // For the -json/-records results
+    const std::string &getName(size_t i) const { return points[i].name; }
+    const std::string &getParams(size_t i) const { return points[i].params; }
+    UINT64 getStorageBits(size_t i) const { return points[i].storage_bits; }
+
+    UINT64 getNumIncorrectPredictions(size_t i)
+    {
+        flush();
+        return groups[points[i].group].misses[points[i].lane];
+    }
+
+    UINT64 getNumCorrectPredictions(size_t i) { return steps - getNumIncorrectPredictions(i); }
+
+    // Checkpoint of the tables and histories, not the statistics (see
+    // predictor_state.h). Only loads into the same grid.
+    void save(PredictorStateWriter &out) const
+    {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            out.put(groups[i].table);
+            out.put(groups[i].folded.value);
+        }
+        for (size_t i = 0; i < bhts.size(); i++)
+            out.put(bhts[i]);
+        global_history.save(out);
+    }
+
+    bool load(PredictorStateReader &in)
+    {
+        bool ok = true;
+        for (size_t i = 0; i < groups.size() && ok; i++)
+            ok = in.get(groups[i].table) && in.get(groups[i].folded.value);
+        for (size_t i = 0; i < bhts.size() && ok; i++)
+            ok = in.get(bhts[i]);
+        return ok && global_history.load(in);
+    }
+
+private:
+    enum source_t
+    {
+        SRC_PC,     // ip
+        SRC_GLOBAL, // ip and the global history
+        SRC_LOCAL   // ip and the history of a local BHT
+    };
+
+    struct group_t
+    {
+        source_t source;
+        unsigned index_bits, history_length;
+        size_t bht;
+        bool folded_history; // global history longer than the index
+        FoldedHistory folded;
+
+        unsigned lanes, stride; // stride: 1 or a multiple of 4 bytes
+        std::vector<unsigned char> table;
+
+        // Per lane, padded to at least 16 bytes for the vector loads
+        std::vector<unsigned char> initial, max, threshold, fsm, fsm_offset;
+        std::vector<unsigned char> pending; // mispredictions since the last flush()
+        std::vector<UINT64> misses;
+    };
+
+    struct point_t
+    {
+        std::string name, params; // getParams() of the equivalent predictor
+        UINT64 storage_bits;
+        size_t group;
+        unsigned lane;
+    };
+
+    size_t findGroup(source_t source, unsigned index_bits, unsigned history_length, size_t bht)
+    {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            const group_t &g = groups[i];
+            if (g.source == source && g.index_bits == index_bits &&
+                g.history_length == history_length && g.bht == bht)
+                return i;
+        }
+
+        group_t g;
+        g.source = source;
+        g.index_bits = index_bits;
+        g.history_length = history_length;
+        g.bht = bht;
+        g.folded_history = source == SRC_GLOBAL && history_length > index_bits;
+        g.folded.init(history_length, index_bits);
+        g.lanes = 0;
+        g.stride = 0;
+        groups.push_back(g);
+        return groups.size() - 1;
+    }
+
+    // p: the equivalent predictor, for the name, params and storage bits
+    void addLane(size_t group, BranchPredictor &p, unsigned char initial, unsigned char max,
+                 unsigned char threshold, bool fsm, unsigned char fsm_offset)
+    {
+        group_t &g = groups[group];
+        unsigned lane = g.lanes++;
+
+        // 1, 4, 8 or a multiple of 16 bytes
+        g.stride = (g.lanes == 1) ? 1 : (g.lanes <= 4) ? 4 : (g.lanes <= 8) ? 8 : (g.lanes + 15) & ~15u;
+
+        size_t padded = (g.stride < 16) ? 16 : g.stride;
+        g.initial.resize(padded, 0);
+        g.max.resize(padded, 0);
+        g.threshold.resize(padded, 0);
+        g.fsm.resize(padded, 0);
+        g.fsm_offset.resize(padded, 0);
+        g.pending.resize(padded, 0);
+        g.misses.resize(g.lanes, 0);
+
+        g.initial[lane] = initial;
+        g.max[lane] = max;
+        g.threshold[lane] = threshold;
+        g.fsm[lane] = fsm ? 0xff : 0;
+        g.fsm_offset[lane] = fsm_offset;
+
+        // Nothing has been simulated yet, so the rows are simply rebuilt
+        size_t entries = (size_t)1 << g.index_bits;
+        g.table.resize(entries * g.stride);
+        for (size_t e = 0; e < entries; e++)
+            memcpy(&g.table[e * g.stride], &g.initial[0], g.stride);
+
+        point_t point = {p.getName(), p.getParams(), p.getStorageBits(), group, lane};
+        points.push_back(point);
+    }
+
+    unsigned index(const group_t &g, ADDRINT ip) const
+    {
+        unsigned mask = (1u << g.index_bits) - 1;
+        switch (g.source)
+        {
+        case SRC_PC:
+            return ip & mask;
+        case SRC_GLOBAL:
+            if (g.folded_history)
+                return g.folded.value;
+            return ((unsigned)(ip << g.history_length) | global_history.recent(g.history_length)) & mask;
+        default:
+        {
+            const std::vector<HistoryRegister<16>> &bht = bhts[g.bht];
+            const HistoryRegister<16> &local_history = bht[ip & (bht.size() - 1)];
+            return ((unsigned)(ip << g.history_length) | local_history.recent(g.history_length)) & mask;
+        }
+        }
+    }
+
+    void updateRow(group_t &g, unsigned char *row, bool taken)
+    {
+#if defined(__SSE4_1__)
+        if (g.stride > 1)
+        {
+            const __m128i next = _mm_loadu_si128((const __m128i *)fsm_next[taken]);
+            const __m128i taken_mask = _mm_set1_epi8(taken ? -1 : 0), one = _mm_set1_epi8(1);
+
+            for (unsigned off = 0; off < g.stride; off += 16)
+            {
+                __m128i c = loadLanes(row + off, g.stride);
+                __m128i max = _mm_loadu_si128((const __m128i *)&g.max[off]);
+                __m128i threshold = _mm_loadu_si128((const __m128i *)&g.threshold[off]);
+
+                // Predicted taken where c >= threshold
+                __m128i predicted = _mm_cmpeq_epi8(_mm_max_epu8(c, threshold), c);
+                __m128i miss = _mm_xor_si128(predicted, taken_mask);
+                __m128i pending = _mm_loadu_si128((const __m128i *)&g.pending[off]);
+                _mm_storeu_si128((__m128i *)&g.pending[off], _mm_sub_epi8(pending, miss));
+
+                __m128i counter = taken ? _mm_min_epu8(_mm_adds_epu8(c, one), max) : _mm_subs_epu8(c, one);
+                __m128i fsm_state = _mm_add_epi8(c, _mm_loadu_si128((const __m128i *)&g.fsm_offset[off]));
+                __m128i fsm = _mm_shuffle_epi8(next, fsm_state);
+                c = _mm_blendv_epi8(counter, fsm, _mm_loadu_si128((const __m128i *)&g.fsm[off]));
+                storeLanes(row + off, g.stride, c);
+            }
+            return;
+        }
+#endif
+        for (unsigned lane = 0; lane < g.lanes; lane++)
+        {
+            unsigned char c = row[lane];
+            if ((c >= g.threshold[lane]) != taken)
+                g.pending[lane]++;
+
+            if (g.fsm[lane])
+                row[lane] = fsm_next[taken][g.fsm_offset[lane] + c];
+            else if (taken)
+                row[lane] = (c < g.max[lane]) ? c + 1 : c;
+            else
+                row[lane] = (c > 0) ? c - 1 : 0;
+        }
+    }
+
+#if defined(__SSE4_1__)
+    static __m128i loadLanes(const unsigned char *p, unsigned stride)
+    {
+        if (stride == 4)
+        {
+            int v;
+            memcpy(&v, p, 4);
+            return _mm_cvtsi32_si128(v);
+        }
+        if (stride == 8)
+            return _mm_loadl_epi64((const __m128i *)p);
+        return _mm_loadu_si128((const __m128i *)p);
+    }
+
+    static void storeLanes(unsigned char *p, unsigned stride, __m128i v)
+    {
+        if (stride == 4)
+        {
+            int x = _mm_cvtsi128_si32(v);
+            memcpy(p, &x, 4);
+        }
+        else if (stride == 8)
+            _mm_storel_epi64((__m128i *)p, v);
+        else
+            _mm_storeu_si128((__m128i *)p, v);
+    }
+#endif
+
+    // Moves the 8-bit pending counts into the 64-bit totals
+    void flush()
+    {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            group_t &g = groups[i];
+            for (unsigned lane = 0; lane < g.lanes; lane++)
+                g.misses[lane] += g.pending[lane];
+            std::fill(g.pending.begin(), g.pending.end(), 0);
+        }
+        pending_steps = 0;
+    }
+
+    std::vector<group_t> groups;
+    std::vector<point_t> points;
+    UINT64 steps;
+    unsigned pending_steps;
+
+    unsigned char fsm_next[2][16];
+
+    std::vector<std::vector<HistoryRegister<16>>> bhts; // one per BHT size
+    DynamicHistoryRegister global_history;
+    unsigned max_global_history;
+};
+
+#endif
@@ -2,47 +2,275 @@
 #define RAS_H
 
 #include <vector>
+#include <algorithm> // std::max
 
+#include "predictor_state.h"
+
+//> What a full RAS does on a call:
+//  RAS_WRAP overwrites the oldest entry (circular buffer),
+//  RAS_DROP ignores the new entry and mispredicts its return.
+enum RASOverflowPolicy
+{
+    RAS_WRAP,
+    RAS_DROP
+};
+
+//> Saved top-of-stack state, to undo pushes/pops done on a wrong path.
+struct RASCheckpoint
+{
+    UINT32 tos, size;
+    UINT64 dropped;
+    ADDRINT top;
+    std::vector<UINT32> count;
+    std::vector<UINT64> lost;
+};
+
+/**
+ * Return address stack on a fixed circular buffer, so push and pop are O(1).
+ *
+ * A RAS can simulate several depths at once: with either policy a smaller
+ * RAS always holds a part of the entries of the largest one (the newest
+ * entries for RAS_WRAP, the oldest for RAS_DROP), so a single buffer plus an
+ * entry count per depth gives the results of a separate RAS per depth.
+ *
+ * Mispredictions are also split into underflows (return with an empty
+ * stack) and overflows (return whose entry was lost because the stack was
+ * full).
+ **/
 class RAS
 {
 public:
-    RAS(UINT32 num_entries) 
-      : max_entries(num_entries), correct(0), incorrect(0) {};
+    RAS(UINT32 num_entries, RASOverflowPolicy policy_ = RAS_WRAP)
+        : policy(policy_), depths(1)
+    {
+        depths[0].max_entries = num_entries;
+        init();
+    }
+
+    RAS(const std::vector<UINT32> &entries, RASOverflowPolicy policy_ = RAS_WRAP)
+        : policy(policy_), depths(entries.size())
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+            depths[i].max_entries = entries[i];
+        init();
+    }
+
     ~RAS() {};
 
     void push_addr(ADDRINT addr) {
-        addr_vec.push_back(addr);
-        if (addr_vec.size() > max_entries)
-            addr_vec.erase(addr_vec.begin());
+        for (size_t i = 0; i < depths.size(); i++) {
+            ras_depth_t &d = depths[i];
+            if (d.count < d.max_entries) {
+                d.count++;
+            } else {
+                d.overflows++;
+                d.lost++;
+            }
+        }
+
+        if (size == capacity) {
+            if (policy == RAS_DROP) {
+                dropped++;
+                return;
+            }
+        } else {
+            size++;
+        }
+        tos = (tos + 1 == capacity) ? 0 : tos + 1;
+        stack[tos] = addr;
     }
 
     void pop_addr(ADDRINT target) {
-        if (addr_vec.empty()) {
-            incorrect++;
-            return;
+        for (size_t i = 0; i < depths.size(); i++) {
+            ras_depth_t &d = depths[i];
+
+            // The return of a dropped call, the stack itself is still right
+            if (policy == RAS_DROP && d.lost > 0) {
+                d.lost--;
+                d.incorrect++;
+                d.overflow_incorrect++;
+                continue;
+            }
+
+            if (d.count == 0) {
+                d.incorrect++;
+                if (d.lost > 0) { // the entry was overwritten (RAS_WRAP)
+                    d.lost--;
+                    d.overflow_incorrect++;
+                } else {
+                    d.underflow_incorrect++;
+                }
+                continue;
+            }
+
+            // RAS_WRAP keeps the newest entries of the shared stack,
+            // RAS_DROP the oldest ones (the stack never wraps then).
+            ADDRINT ras_ip = (policy == RAS_WRAP) ? stack[tos] : stack[d.count - 1];
+            d.count--;
+
+            if (ras_ip == target)
+                d.correct++;
+            else
+                d.incorrect++;
+        }
+
+        if (dropped > 0) {
+            dropped--;
+        } else if (size > 0) {
+            size--;
+            tos = (tos == 0) ? capacity - 1 : tos - 1;
+        }
+    }
+
+    // Saves the top-of-stack pointer and entry. The vectors of cp are reused,
+    // so checkpointing on every branch does not allocate.
+    void checkpoint(RASCheckpoint &cp) const {
+        cp.tos = tos;
+        cp.size = size;
+        cp.dropped = dropped;
+        cp.top = stack[tos];
+        cp.count.resize(depths.size());
+        cp.lost.resize(depths.size());
+        for (size_t i = 0; i < depths.size(); i++) {
+            cp.count[i] = depths[i].count;
+            cp.lost[i] = depths[i].lost;
+        }
+    }
+
+    // Undoes everything pushed or popped since checkpoint(cp). Entries below
+    // the saved top that were overwritten in between are not recovered, as
+    // in a hardware RAS that only checkpoints the top. cslab_replay -check_ras
+    // checks this on the calls and returns of a trace.
+    void restore(const RASCheckpoint &cp) {
+        tos = cp.tos;
+        size = cp.size;
+        dropped = cp.dropped;
+        stack[tos] = cp.top;
+        for (size_t i = 0; i < depths.size(); i++) {
+            depths[i].count = cp.count[i];
+            depths[i].lost = cp.lost[i];
         }
+    }
 
-        ADDRINT ras_ip = *(addr_vec.end() - 1);
-        addr_vec.pop_back();
+    // The stack and the entry count of every depth, see predictor_state.h
+    void saveState(PredictorStateWriter &out) const {
+        out.put(stack);
+        out.put(tos);
+        out.put(size);
+        out.put(dropped);
+        for (size_t i = 0; i < depths.size(); i++) {
+            out.put(depths[i].count);
+            out.put(depths[i].lost);
+        }
+    }
 
-        if (ras_ip == target)
-            correct++;
-        else
-            incorrect++;
+    bool loadState(PredictorStateReader &in) {
+        if (!in.get(stack) || !in.get(tos) || !in.get(size) || !in.get(dropped))
+            return false;
+        for (size_t i = 0; i < depths.size(); i++)
+            if (!in.get(depths[i].count) || !in.get(depths[i].lost))
+                return false;
+        return true;
     }
 
-    string getNameAndStats() { 
+    // Same entries, top of stack and entry count of every depth as other, a
+    // copy of this RAS. The slots above the top are never read again, so
+    // they and the statistics are not compared.
+    bool sameStack(const RAS &other) const {
+        if (tos != other.tos || size != other.size || dropped != other.dropped)
+            return false;
+        for (UINT32 i = 0, pos = tos; i < size; i++, pos = (pos == 0) ? capacity - 1 : pos - 1)
+            if (stack[pos] != other.stack[pos])
+                return false;
+        for (size_t i = 0; i < depths.size(); i++)
+            if (depths[i].count != other.depths[i].count || depths[i].lost != other.depths[i].lost)
+                return false;
+        return true;
+    }
+
+    size_t getNumDepths() { return depths.size(); }
+
+    RASOverflowPolicy getPolicy() const { return policy; }
+
+    // Clears the statistics of every depth, the stack contents are kept
+    void resetCounters() {
+        for (size_t i = 0; i < depths.size(); i++) {
+            ras_depth_t &d = depths[i];
+            d.correct = d.incorrect = 0;
+            d.overflows = d.overflow_incorrect = d.underflow_incorrect = 0;
+        }
+    }
+
+    // Adds the statistics of an identical RAS, e.g. the copy of another thread
+    void mergeCounters(const RAS &other) {
+        for (size_t i = 0; i < depths.size(); i++) {
+            ras_depth_t &d = depths[i];
+            const ras_depth_t &o = other.depths[i];
+            d.correct += o.correct;
+            d.incorrect += o.incorrect;
+            d.overflows += o.overflows;
+            d.overflow_incorrect += o.overflow_incorrect;
+            d.underflow_incorrect += o.underflow_incorrect;
+        }
+    }
+
+    string getNameAndStats(size_t i = 0) {
         std::ostringstream stream;
-        stream << "RAS (" << max_entries << " entries): " << correct <<
-                                                      " " << incorrect;
-        return stream.str(); 
+        stream << getName(i) << ": " << depths[i].correct <<
+                                 " " << depths[i].incorrect;
+        return stream.str();
     };
 
+    string getOverflowStats(size_t i = 0) {
+        std::ostringstream stream;
+        stream << getName(i) << ": " << depths[i].overflows <<
+                                 " " << depths[i].overflow_incorrect <<
+                                 " " << depths[i].underflow_incorrect;
+        return stream.str();
+    }
+
 private:
-    UINT32 max_entries;
-    std::vector<ADDRINT> addr_vec;
+    void init() {
+        for (size_t i = 0; i < depths.size(); i++) {
+            ras_depth_t &d = depths[i];
+            d.count = 0;
+            d.lost = 0;
+            d.correct = d.incorrect = 0;
+            d.overflows = d.overflow_incorrect = d.underflow_incorrect = 0;
+        }
+        capacity = 1;
+        for (size_t i = 0; i < depths.size(); i++)
+            capacity = std::max(capacity, depths[i].max_entries);
+        stack.assign(capacity, 0);
+        tos = capacity - 1;
+        size = 0;
+        dropped = 0;
+    }
+
+    string getName(size_t i) {
+        std::ostringstream stream;
+        stream << "RAS (" << depths[i].max_entries << " entries";
+        if (policy == RAS_DROP)
+            stream << ", drop";
+        stream << ")";
+        return stream.str();
+    }
+
+    struct ras_depth_t {
+        UINT32 max_entries;
+        UINT32 count; // valid entries
+        UINT64 lost;  // entries lost to overflows, not returned to yet
+        unsigned long long correct, incorrect;
+        unsigned long long overflows, overflow_incorrect, underflow_incorrect;
+    };
+
+    RASOverflowPolicy policy;
+    std::vector<ras_depth_t> depths;
 
-    unsigned long long correct, incorrect;
+    // Shared circular stack, as large as the largest depth
+    std::vector<ADDRINT> stack;
+    UINT32 capacity, tos, size;
+    UINT64 dropped; // calls not pushed on the full stack (RAS_DROP)
 };
 
 #endif
@@ -0,0 +1,214 @@
+#ifndef RESULTS_OUTPUT_H
+#define RESULTS_OUTPUT_H
+
+#include <cstdint> // uint64_t
+#include <cstdio>  // snprintf()
+#include <fstream>
+#include <sstream>
+#include <string>
+
+/**
+ * Machine-readable results of cslab_branch and cslab_replay (-json,
+ * -records), written by Fini() next to the text report with the same
+ * numbers, so that the scripts aggregating many runs load them instead of
+ * parsing the "  <name>: <correct> <incorrect>" lines. Pin independent.
+ *
+ * JSON lines, one object per predictor, with these keys in this order
+ * (schema 1):
+ *
+ *   {"schema":1,"run":"cslab_branch.out","kind":"branch","name":"Global-N4-X2-16KPHT",
+ *    "params":{"type":"Global","pht_entries":16384,"counter_bits":2,"bhr_length":4},
+ *    "storage_bits":32772,"instructions":...,"correct":...,"incorrect":...,
+ *    "mpki":1.2345,"target_correct":null}
+ *
+ * kind is "branch" or "btb". params is BranchPredictor::getParams(), its
+ * "type" is the predictor_config.h name. storage_bits is null when it is
+ * not modelled (Pentium-M), target_correct for everything but the BTBs,
+ * instructions and mpki for the counts of a -simpoints run that are not
+ * whole-run estimates.
+ * run is the text output file of the run.
+ *
+ * Records, native byte order and 8-byte aligned like predictor_state.h:
+ *   header:  "CSLBRS" + 2-byte version, uint64 run_bytes, run
+ *   records: uint32 kind (0 branch, 1 btb), uint32 name_bytes, uint64 params_bytes,
+ *            uint64 storage_bits, instructions, correct, incorrect, target_correct,
+ *            name, params (the JSON object)
+ * with RESULTS_NONE (all ones) for null; MPKI is not stored.
+ **/
+
+static const char RESULTS_MAGIC[6] = {'C', 'S', 'L', 'B', 'R', 'S'};
+static const uint16_t RESULTS_VERSION = 1;
+
+// No value: storage bits that are not modelled, target hits of a non-BTB
+static const uint64_t RESULTS_NONE = ~(uint64_t)0;
+
+// Builds the "params" object of a predictor, type first
+class JsonObject
+{
+public:
+    explicit JsonObject(const std::string &type) { stream << "{\"type\":" << quote(type); }
+
+    JsonObject &add(const char *key, uint64_t value)
+    {
+        stream << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    JsonObject &add(const char *key, const std::string &value)
+    {
+        stream << ",\"" << key << "\":" << quote(value);
+        return *this;
+    }
+
+    // value is JSON already, e.g. the params of a component
+    JsonObject &addRaw(const char *key, const std::string &value)
+    {
+        stream << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    std::string str() const { return stream.str() + "}"; }
+
+    static std::string quote(const std::string &s)
+    {
+        std::string q = "\"";
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            unsigned char c = s[i];
+            if (c == '"' || c == '\\')
+                q += '\\';
+            if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                q += escaped;
+            }
+            else
+                q += c;
+        }
+        return q + "\"";
+    }
+
+private:
+    std::ostringstream stream;
+};
+
+class ResultsWriter
+{
+public:
+    enum kind_t
+    {
+        BRANCH = 0,
+        BTB = 1
+    };
+
+    // Either file name may be empty. run: identifies the run in every record.
+    bool open(const std::string &json_file, const std::string &records_file, const std::string &run_)
+    {
+        run = run_;
+        if (!json_file.empty())
+        {
+            json.open(json_file.c_str());
+            if (!json.is_open())
+                return false;
+        }
+        if (!records_file.empty())
+        {
+            records.open(records_file.c_str(), std::ios::out | std::ios::binary);
+            if (!records.is_open())
+                return false;
+            records.write(RESULTS_MAGIC, sizeof(RESULTS_MAGIC));
+            records.write((const char *)&RESULTS_VERSION, sizeof(RESULTS_VERSION));
+            put((uint64_t)run.size());
+            append(run);
+        }
+        return true;
+    }
+
+    bool isOpen() const { return json.is_open() || records.is_open(); }
+
+    // storage_bits, instructions, target_correct: RESULTS_NONE if there is none
+    // (instructions: then the MPKI is null too)
+    void add(kind_t kind, const std::string &name, const std::string &params, uint64_t storage_bits,
+             uint64_t instructions, uint64_t correct, uint64_t incorrect, uint64_t target_correct)
+    {
+        if (json.is_open())
+        {
+            json << "{\"schema\":" << RESULTS_VERSION
+                 << ",\"run\":" << JsonObject::quote(run)
+                 << ",\"kind\":" << (kind == BTB ? "\"btb\"" : "\"branch\"")
+                 << ",\"name\":" << JsonObject::quote(name)
+                 << ",\"params\":" << params
+                 << ",\"storage_bits\":" << value(storage_bits)
+                 << ",\"instructions\":" << value(instructions)
+                 << ",\"correct\":" << correct
+                 << ",\"incorrect\":" << incorrect
+                 << ",\"mpki\":" << mpki(incorrect, instructions)
+                 << ",\"target_correct\":" << value(target_correct) << "}\n";
+        }
+        if (records.is_open())
+        {
+            uint32_t head[2] = {(uint32_t)kind, (uint32_t)name.size()};
+            records.write((const char *)head, sizeof(head));
+            put((uint64_t)params.size());
+            put(storage_bits);
+            put(instructions);
+            put(correct);
+            put(incorrect);
+            put(target_correct);
+            append(name);
+            append(params);
+        }
+    }
+
+    // False if a write failed
+    bool close()
+    {
+        bool ok = true;
+        if (json.is_open())
+        {
+            ok = ok && json.good();
+            json.close();
+        }
+        if (records.is_open())
+        {
+            ok = ok && records.good();
+            records.close();
+        }
+        return ok;
+    }
+
+private:
+    static std::string value(uint64_t v)
+    {
+        if (v == RESULTS_NONE)
+            return "null";
+        std::ostringstream stream;
+        stream << v;
+        return stream.str();
+    }
+
+    static std::string mpki(uint64_t incorrect, uint64_t instructions)
+    {
+        if (instructions == 0 || instructions == RESULTS_NONE)
+            return "null";
+        char text[32];
+        snprintf(text, sizeof(text), "%.6f", incorrect / (instructions / 1000.0));
+        return text;
+    }
+
+    void put(uint64_t v) { records.write((const char *)&v, sizeof(v)); }
+
+    // Bytes zero-padded to a multiple of 8
+    void append(const std::string &s)
+    {
+        static const char zeros[8] = {0};
+        records.write(s.data(), s.size());
+        records.write(zeros, (8 - s.size() % 8) % 8);
+    }
+
+    std::string run;
+    std::ofstream json, records;
+};
+
+#endif
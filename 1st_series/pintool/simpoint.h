@@ -0,0 +1,244 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm> // std::sort
+
+/**
+ * SimPoint-style sampled simulation, for the ref runs that take hours:
+ *
+ *   1. cslab_branch -bbv gcc.bb -interval 100000000
+ *        profiles a basic-block vector per interval, no predictors
+ *   2. cslab_simpoint -i gcc.bb -o gcc
+ *        clusters the vectors (k-means, k chosen by BIC) and writes the
+ *        representative intervals and their weights, gcc.simpoints and
+ *        gcc.weights, in the format of the SimPoint 3 tool
+ *   3. cslab_branch -simpoints gcc.simpoints -weights gcc.weights
+ *                   -interval 100000000 -warmup 10000000
+ *        simulates the predictors only in the chosen intervals, each after
+ *        a warm-up, and reports the weighted estimate
+ *   4. simpoint_error.py <sampled outputs> ref
+ *        MPKI error of the estimate against the full runs
+ *
+ * BbvProfiler writes step 1 in the SimPoint .bb format, one line per
+ * interval: "T:<block id>:<instructions executed in the block> ...".
+ * SimPointSampler schedules step 3.
+ **/
+
+class BbvProfiler
+{
+public:
+    BbvProfiler() : interval(0), next_dump(0), counts(1, 0) {}
+
+    bool open(const std::string &filename, UINT64 interval_)
+    {
+        interval = interval_;
+        next_dump = interval_;
+        file.open(filename.c_str());
+        return file.is_open();
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Block ids start at 1 (SimPoint convention). Called at instrumentation
+    // time, so the analysis calls never grow the tables.
+    UINT32 blockId(ADDRINT addr)
+    {
+        std::map<ADDRINT, UINT32>::iterator it = ids.find(addr);
+        if (it != ids.end())
+            return it->second;
+        UINT32 id = counts.size();
+        ids[addr] = id;
+        counts.push_back(0);
+        return id;
+    }
+
+    // now: the instruction count of the run, so that the intervals are the
+    // same as those of the -simpoints run
+    void count(UINT32 id, UINT32 num_ins, UINT64 now)
+    {
+        if (counts[id] == 0)
+            touched.push_back(id);
+        counts[id] += num_ins;
+        if (now >= next_dump)
+        {
+            dump();
+            next_dump += interval;
+        }
+    }
+
+    // Writes the last, partial interval
+    void close()
+    {
+        if (!touched.empty())
+            dump();
+        file.close();
+    }
+
+private:
+    void dump()
+    {
+        std::sort(touched.begin(), touched.end());
+        file << "T";
+        for (size_t i = 0; i < touched.size(); i++)
+        {
+            file << ":" << touched[i] << ":" << counts[touched[i]] << " ";
+            counts[touched[i]] = 0;
+        }
+        file << "\n";
+        touched.clear();
+    }
+
+    std::ofstream file;
+    UINT64 interval, next_dump;
+    std::map<ADDRINT, UINT32> ids;
+    std::vector<UINT64> counts; // per block id, index 0 unused
+    std::vector<UINT32> touched; // ids with a count in the current interval
+};
+
+class SimPointSampler
+{
+public:
+    enum phase_t
+    {
+        FAST_FORWARD, // only count instructions
+        WARMUP,       // simulate, the statistics are not used
+        MEASURE,      // simulate the chosen interval
+        DONE
+    };
+
+    SimPointSampler() : interval(0), warmup(0), current(0), phase(DONE) {}
+
+    // SimPoint 3 output: "<interval> <cluster>" and "<weight> <cluster>" lines
+    bool load(const std::string &simpoints_file, const std::string &weights_file, std::string &error)
+    {
+        std::map<unsigned, UINT64> intervals;
+        std::map<unsigned, double> weights;
+        if (!readPairs(simpoints_file, intervals, error) || !readPairs(weights_file, weights, error))
+            return false;
+
+        for (std::map<unsigned, UINT64>::iterator it = intervals.begin(); it != intervals.end(); ++it)
+        {
+            if (!weights.count(it->first))
+            {
+                std::ostringstream stream;
+                stream << weights_file << ": no weight for cluster " << it->first;
+                error = stream.str();
+                return false;
+            }
+            point_t p = {it->second, weights[it->first]};
+            points.push_back(p);
+        }
+        if (points.empty())
+        {
+            error = simpoints_file + ": no simulation points";
+            return false;
+        }
+        std::sort(points.begin(), points.end());
+        return true;
+    }
+
+    bool active() const { return !points.empty(); }
+    size_t size() const { return points.size(); }
+
+    void start(UINT64 interval_, UINT64 warmup_)
+    {
+        interval = interval_;
+        warmup = warmup_;
+        current = 0;
+        phase = FAST_FORWARD;
+        settle(0);
+    }
+
+    // Called when now reaches nextEvent()
+    void advance(UINT64 now)
+    {
+        if (phase == FAST_FORWARD)
+            phase = WARMUP;
+        else if (phase == WARMUP)
+            phase = MEASURE;
+        else if (phase == MEASURE)
+        {
+            current++;
+            phase = (current == points.size()) ? DONE : FAST_FORWARD;
+        }
+        settle(now);
+    }
+
+    phase_t getPhase() const { return phase; }
+
+    // Weight of the interval being measured
+    double weight() const { return points[current].weight; }
+
+    // Number of the interval being measured (-interval instructions each)
+    UINT64 currentInterval() const { return points[current].interval; }
+
+    // Instruction count of the next phase change
+    UINT64 nextEvent() const
+    {
+        switch (phase)
+        {
+        case FAST_FORWARD:
+            return warmupStart(current);
+        case WARMUP:
+            return begin(current);
+        case MEASURE:
+            return begin(current) + interval;
+        default:
+            return ~0ULL;
+        }
+    }
+
+private:
+    struct point_t
+    {
+        UINT64 interval;
+        double weight;
+        bool operator<(const point_t &other) const { return interval < other.interval; }
+    };
+
+    template <typename T>
+    static bool readPairs(const std::string &filename, std::map<unsigned, T> &values, std::string &error)
+    {
+        std::ifstream in(filename.c_str());
+        if (!in)
+        {
+            error = "could not open " + filename;
+            return false;
+        }
+        T value;
+        unsigned cluster;
+        while (in >> value >> cluster)
+            values[cluster] = value;
+        if (!in.eof())
+        {
+            error = filename + ": expected \"<value> <cluster>\" lines";
+            return false;
+        }
+        return true;
+    }
+
+    UINT64 begin(size_t i) const { return points[i].interval * interval; }
+    UINT64 warmupStart(size_t i) const { return (begin(i) > warmup) ? begin(i) - warmup : 0; }
+
+    // Skips the phases that are already over, e.g. the fast-forward to a
+    // point whose warm-up overlaps the previous point
+    void settle(UINT64 now)
+    {
+        if (phase == FAST_FORWARD && now >= warmupStart(current))
+            phase = WARMUP;
+        if (phase == WARMUP && now >= begin(current))
+            phase = MEASURE;
+    }
+
+    std::vector<point_t> points; // sorted by interval
+    UINT64 interval, warmup;
+    size_t current;
+    phase_t phase;
+};
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef STATIC_PREDICTORS_H
+#define STATIC_PREDICTORS_H
+
+#include <sstream> // std::ostringstream
+#include <cmath>   // pow()
+#include <cstdint> // uint8_t
+#include <cstring> // memset()
+#include <string>
+
+#include "history_register.h"
+#include "results_output.h"
+
+/**
+ * Compile-time configured versions of the predictors in branch_predictor.h.
+ * Table sizes, counter widths and history lengths are template parameters,
+ * so indexing reduces to constant masks, and a PredictorSet calls every
+ * predictor without virtual dispatch (the per-branch loop is fully unrolled).
+ * Predictions and names are identical to the runtime-configured classes,
+ * which stay available for ad-hoc runs, and so are getParams() and
+ * getStorageBits().
+ *
+ * Enabled in cslab_branch with `make CSLAB_STATIC_PREDICTORS=1`.
+ **/
+namespace ct
+{
+
+constexpr unsigned log2(unsigned n) { return (n <= 1) ? 0 : 1 + log2(n >> 1); }
+constexpr bool isPowerOf2(unsigned n) { return n != 0 && (n & (n - 1)) == 0; }
+
+// Prediction counters, same as BranchPredictor but without the vtable.
+class PredictorCounters
+{
+public:
+    PredictorCounters() : correct_predictions(0), incorrect_predictions(0) {}
+
+    UINT64 getNumCorrectPredictions() { return correct_predictions; }
+    UINT64 getNumIncorrectPredictions() { return incorrect_predictions; }
+
+    void resetCounters() { correct_predictions = incorrect_predictions = 0; }
+
+protected:
+    void updateCounters(bool predicted, bool actual)
+    {
+        if (predicted == actual)
+            correct_predictions++;
+        else
+            incorrect_predictions++;
+    }
+
+private:
+    UINT64 correct_predictions;
+    UINT64 incorrect_predictions;
+};
+
+template <unsigned IndexBits, unsigned CntrBits>
+class NbitPredictor : public PredictorCounters
+{
+    static_assert(CntrBits >= 1 && CntrBits <= 8, "counters are kept in bytes");
+
+public:
+    static constexpr unsigned TABLE_ENTRIES = 1u << IndexBits;
+    static constexpr unsigned INDEX_MASK = TABLE_ENTRIES - 1;
+    static constexpr uint8_t COUNTER_MAX = (1u << CntrBits) - 1;
+
+    NbitPredictor() { memset(TABLE, 0, sizeof(TABLE)); }
+
+    bool predict(ADDRINT ip, ADDRINT target) const
+    {
+        return (TABLE[ip & INDEX_MASK] >> (CntrBits - 1)) != 0;
+    }
+
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        uint8_t &counter = TABLE[ip & INDEX_MASK];
+        if (actual)
+        {
+            if (counter < COUNTER_MAX)
+                counter++;
+        }
+        else if (counter > 0)
+            counter--;
+        updateCounters(predicted, actual);
+    }
+
+    std::string getName()
+    {
+        std::ostringstream stream;
+        stream << "Nbit-" << pow(2.0, double(IndexBits)) / 1024.0 << "K-" << CntrBits;
+        return stream.str();
+    }
+
+    std::string getParams() { return JsonObject("Nbit").add("index_bits", IndexBits).add("counter_bits", CntrBits).str(); }
+    UINT64 getStorageBits() { return (UINT64)TABLE_ENTRIES * CntrBits; }
+
+private:
+    uint8_t TABLE[TABLE_ENTRIES];
+};
+
+template <unsigned Row>
+class FSMPredictor : public PredictorCounters
+{
+    static_assert(Row >= 2 && Row <= 5, "FSMPredictor row must be between 2 and 5");
+
+public:
+    static constexpr unsigned TABLE_ENTRIES = 1u << 14;
+    static constexpr unsigned INDEX_MASK = TABLE_ENTRIES - 1;
+
+    FSMPredictor() { memset(TABLE, 0, sizeof(TABLE)); }
+
+    bool predict(ADDRINT ip, ADDRINT target) const
+    {
+        return (TABLE[ip & INDEX_MASK] >> 1) != 0;
+    }
+
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        uint8_t &state = TABLE[ip & INDEX_MASK];
+        state = transitions[Row - 2][actual ? 1 : 0][state];
+        updateCounters(predicted, actual);
+    }
+
+    std::string getName()
+    {
+        std::ostringstream stream;
+        stream << "FSM-Row-" << Row;
+        return stream.str();
+    }
+
+    std::string getParams() { return JsonObject("FSM").add("row", Row).add("index_bits", 14).str(); }
+    UINT64 getStorageBits() { return (UINT64)TABLE_ENTRIES * 2; }
+
+private:
+    static constexpr uint8_t transitions[4][2][4] = {
+        {{0, 0, 0, 2}, {1, 2, 3, 3}}, // Row 2
+        {{0, 0, 1, 2}, {1, 3, 3, 3}}, // Row 3
+        {{0, 0, 0, 2}, {1, 3, 3, 3}}, // Row 4
+        {{0, 0, 1, 2}, {1, 3, 3, 2}}, // Row 5
+    };
+    uint8_t TABLE[TABLE_ENTRIES];
+};
+template <unsigned Row>
+constexpr uint8_t FSMPredictor<Row>::transitions[4][2][4];
+
+template <unsigned PhtEntries, unsigned CntrBits, unsigned BhrLength>
+class GlobalHistoryPredictor : public PredictorCounters
+{
+    static_assert(isPowerOf2(PhtEntries), "PHT entries must be a power of 2");
+    static_assert(BhrLength >= 1, "the BHR needs at least 1 bit");
+    static_assert(CntrBits >= 1 && CntrBits <= 8, "counters are kept in bytes");
+
+public:
+    static constexpr unsigned PHT_INDEX_MASK = PhtEntries - 1;
+    static constexpr unsigned PHT_INDEX_BITS = log2(PhtEntries);
+    static constexpr uint8_t COUNTER_MAX = (1u << CntrBits) - 1;
+    static constexpr bool FOLDED = BhrLength > PHT_INDEX_BITS;
+
+    GlobalHistoryPredictor()
+    {
+        memset(PHT, 1, sizeof(PHT));
+        BHR_folded.init(BhrLength, PHT_INDEX_BITS);
+    }
+
+    bool predict(ADDRINT ip, ADDRINT target) const
+    {
+        return (PHT[index(ip)] >> (CntrBits - 1)) != 0;
+    }
+
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        uint8_t &counter = PHT[index(ip)];
+        if (actual)
+        {
+            if (counter < COUNTER_MAX)
+                counter++;
+        }
+        else if (counter > 0)
+            counter--;
+
+        if (FOLDED)
+            BHR_folded.update(BHR, actual);
+        BHR.push(actual);
+        updateCounters(predicted, actual);
+    }
+
+    std::string getName()
+    {
+        std::ostringstream stream;
+        stream << "Global"
+               << "-N" << BhrLength
+               << "-X" << CntrBits
+               << "-" << (PhtEntries / 1024) << "KPHT";
+        return stream.str();
+    }
+
+    std::string getParams()
+    {
+        return JsonObject("Global").add("pht_entries", PhtEntries).add("counter_bits", CntrBits)
+            .add("bhr_length", BhrLength).str();
+    }
+
+    UINT64 getStorageBits() { return (UINT64)PhtEntries * CntrBits + BhrLength; }
+
+private:
+    unsigned index(ADDRINT ip) const
+    {
+        if (FOLDED)
+            return BHR_folded.value;
+        // (FOLDED ? 0 : ...) only keeps long histories free of shift-count warnings
+        return ((unsigned(ip) << (FOLDED ? 0 : BhrLength)) | BHR.recent(BhrLength)) & PHT_INDEX_MASK;
+    }
+
+    uint8_t PHT[PhtEntries];
+    HistoryRegister<BhrLength> BHR;
+    FoldedHistory BHR_folded; // only with FOLDED
+};
+
+template <unsigned BhtEntries, unsigned HistoryLength, unsigned PhtEntries, unsigned PhtCntrBits>
+class LocalHistoryPredictor : public PredictorCounters
+{
+    static_assert(isPowerOf2(BhtEntries), "BHT entries must be a power of 2");
+    static_assert(isPowerOf2(PhtEntries), "PHT entries must be a power of 2");
+    static_assert(HistoryLength >= 1 && HistoryLength <= 16, "local histories are at most 16 bits");
+
+public:
+    static constexpr unsigned BHT_INDEX_MASK = BhtEntries - 1;
+    static constexpr unsigned PHT_INDEX_MASK = PhtEntries - 1;
+    static constexpr uint8_t COUNTER_MAX = 3;
+
+    LocalHistoryPredictor() { memset(PHT, 1, sizeof(PHT)); }
+
+    bool predict(ADDRINT ip, ADDRINT target) const
+    {
+        return PHT[index(ip, BHT[ip & BHT_INDEX_MASK])] >= 2;
+    }
+
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        HistoryRegister<HistoryLength> &local_history = BHT[ip & BHT_INDEX_MASK];
+        uint8_t &counter = PHT[index(ip, local_history)];
+        if (actual)
+        {
+            if (counter < COUNTER_MAX)
+                counter++;
+        }
+        else if (counter > 0)
+            counter--;
+
+        local_history.push(actual);
+        updateCounters(predicted, actual);
+    }
+
+    std::string getName()
+    {
+        std::ostringstream stream;
+        stream << "Local-" << BhtEntries << "ent-" << HistoryLength << "hist";
+        return stream.str();
+    }
+
+    std::string getParams()
+    {
+        return JsonObject("Local").add("bht_entries", BhtEntries).add("history_length", HistoryLength)
+            .add("pht_entries", PhtEntries).add("counter_bits", PhtCntrBits).str();
+    }
+
+    UINT64 getStorageBits() { return (UINT64)BhtEntries * HistoryLength + (UINT64)PhtEntries * 2; }
+
+private:
+    static unsigned index(ADDRINT ip, const HistoryRegister<HistoryLength> &local_history)
+    {
+        return ((unsigned(ip) << HistoryLength) | local_history.recent(HistoryLength)) & PHT_INDEX_MASK;
+    }
+
+    HistoryRegister<HistoryLength> BHT[BhtEntries];
+    uint8_t PHT[PhtEntries];
+};
+
+template <unsigned IndexBits, typename P1, typename P2>
+class TournamentHybridPredictor : public PredictorCounters
+{
+public:
+    static constexpr unsigned TABLE_ENTRIES = 1u << IndexBits;
+    static constexpr unsigned INDEX_MASK = TABLE_ENTRIES - 1;
+    static constexpr uint8_t COUNTER_MAX = 3;
+
+    TournamentHybridPredictor() { memset(TABLE, 0, sizeof(TABLE)); }
+
+    bool predict(ADDRINT ip, ADDRINT target) const
+    {
+        if ((TABLE[ip & INDEX_MASK] >> 1) & 1)
+            return predictor2.predict(ip, target);
+        return predictor1.predict(ip, target);
+    }
+
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+    {
+        uint8_t &counter = TABLE[ip & INDEX_MASK];
+        bool prediction1 = predictor1.predict(ip, target);
+        bool prediction2 = predictor2.predict(ip, target);
+
+        if (prediction1 != prediction2)
+        {
+            if (prediction1 == actual && counter > 0)
+                counter--;
+            else if (counter < COUNTER_MAX)
+                counter++;
+        }
+        predictor1.update(prediction1, actual, ip, target);
+        predictor2.update(prediction2, actual, ip, target);
+        updateCounters(predicted, actual);
+    }
+
+    std::string getName()
+    {
+        std::ostringstream stream;
+        stream << "Tournament-" << predictor1.getName() << "-" << predictor2.getName();
+        return stream.str();
+    }
+
+    std::string getParams()
+    {
+        return JsonObject("Tournament").add("index_bits", IndexBits)
+            .addRaw("predictor1", predictor1.getParams()).addRaw("predictor2", predictor2.getParams()).str();
+    }
+
+    UINT64 getStorageBits() { return (UINT64)TABLE_ENTRIES * 2 + predictor1.getStorageBits() + predictor2.getStorageBits(); }
+
+private:
+    uint8_t TABLE[TABLE_ENTRIES];
+    P1 predictor1;
+    P2 predictor2;
+};
+
+class Alpha21264Predictor
+    : public TournamentHybridPredictor<12, LocalHistoryPredictor<1024, 3, 1024, 10>,
+                                       GlobalHistoryPredictor<4096, 2, 4>>
+{
+public:
+    std::string getName() { return "Alpha21264"; }
+    std::string getParams() { return JsonObject("Alpha21264").str(); }
+};
+
+class StaticAlwaysTakenPredictor : public PredictorCounters
+{
+public:
+    bool predict(ADDRINT ip, ADDRINT target) const { return true; }
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) { updateCounters(predicted, actual); }
+    std::string getName() { return "Static-AlwaysTaken"; }
+    std::string getParams() { return JsonObject("StaticAlwaysTaken").str(); }
+    UINT64 getStorageBits() { return 0; }
+};
+
+class StaticBTFNTPredictor : public PredictorCounters
+{
+public:
+    bool predict(ADDRINT ip, ADDRINT target) const { return target < ip; }
+    void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) { updateCounters(predicted, actual); }
+    std::string getName() { return "BTFNT"; }
+    std::string getParams() { return JsonObject("BTFNT").str(); }
+    UINT64 getStorageBits() { return 0; }
+};
+
+/**
+ * A fixed list of predictors, each stored by value. step() runs predict()
+ * and update() of every member, unrolled at compile time.
+ * forEach(f) calls f(predictor) for every member (e.g. for reporting).
+ **/
+template <typename... Predictors>
+class PredictorSet;
+
+template <>
+class PredictorSet<>
+{
+public:
+    void step(ADDRINT ip, ADDRINT target, bool taken) {}
+    template <typename F>
+    void forEach(F &f) {}
+};
+
+template <typename P, typename... Rest>
+class PredictorSet<P, Rest...> : public PredictorSet<Rest...>
+{
+public:
+    inline void step(ADDRINT ip, ADDRINT target, bool taken)
+    {
+        bool pred = predictor.predict(ip, target);
+        predictor.update(pred, taken, ip, target);
+        PredictorSet<Rest...>::step(ip, target, taken);
+    }
+
+    template <typename F>
+    void forEach(F &f)
+    {
+        f(predictor);
+        PredictorSet<Rest...>::forEach(f);
+    }
+
+private:
+    P predictor;
+};
+
+} // namespace ct
+
+#endif
@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+
+# MPKI over time from a `cslab_branch -series` file (CSV or -series_binary).
+#
+# Usage: plot_mpki_series.py <series file> [<predictor prefix> ...]
+#
+# Only the predictors whose names start with one of the prefixes are
+# plotted, all of them when none is given.
+
+import struct
+import sys
+import matplotlib
+matplotlib.use('Agg')
+import matplotlib.pyplot as plt
+
+def read_series(filename):
+	data = open(filename, 'rb').read()
+	if data[:8] == b"CSLABTS1":
+		interval, columns = struct.unpack("<QQ", data[8:24])
+		pos = 24
+		names = []
+		for i in range(columns):
+			end = data.index(b"\n", pos)
+			names.append(data[pos:end].decode())
+			pos = end + 1
+		width = columns + 1
+		count = (len(data) - pos) // (8 * width)
+		values = struct.unpack("<%dQ" % (count * width), data[pos:pos + count * width * 8])
+		rows = [values[i * width:(i + 1) * width] for i in range(count)]
+	else:
+		lines = data.decode().split("\n")
+		names = lines[0].split(",")[1:]
+		rows = [[int(v) for v in line.split(",")] for line in lines[1:] if line]
+	return names, rows
+
+names, rows = read_series(sys.argv[1])
+prefixes = sys.argv[2:]
+
+fig, ax1 = plt.subplots()
+ax1.grid(True)
+
+# Cumulative rows, so an interval is the difference of two consecutive ones
+previous = [0] * (len(names) + 1)
+x_Axis = []
+mpki_Axis = [[] for name in names]
+for row in rows:
+	instructions = row[0] - previous[0]
+	if instructions > 0:
+		x_Axis.append(row[0] / 1e9)
+		for i in range(len(names)):
+			mpki_Axis[i].append((row[i + 1] - previous[i + 1]) / (instructions / 1000.0))
+	previous = row
+
+for i, name in enumerate(names):
+	if not prefixes or any(name.startswith(p) for p in prefixes):
+		ax1.plot(x_Axis, mpki_Axis[i], label=name, linewidth=0.8)
+
+ax1.set_xlabel("Instructions ($10^9$)")
+ax1.set_ylabel("$MPKI$")
+ax1.legend(fontsize="small", loc="upper right")
+
+plt.title("MPKI over time")
+plt.savefig((f"{sys.argv[1]}.png"), bbox_inches="tight")
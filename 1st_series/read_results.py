@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+
+# Loads the results of `cslab_branch -json/-records` (or cslab_replay), the
+# schema is described in pintool/results_output.h.
+#
+# Usage: read_results.py <results file> ...
+#
+# Prints one CSV line per predictor of every file: run, kind, name,
+# storage bits, MPKI. Other scripts can import read_results() instead.
+
+import json
+import struct
+import sys
+
+NONE = 2**64 - 1
+
+def padded(n):
+	return (n + 7) & ~7
+
+def read_results(filename):
+	data = open(filename, 'rb').read()
+	if data[:6] != b"CSLBRS":
+		return [json.loads(line) for line in data.decode().split("\n") if line]
+
+	version, = struct.unpack("<H", data[6:8])
+	run_bytes, = struct.unpack("<Q", data[8:16])
+	run = data[16:16 + run_bytes].decode()
+	pos = 16 + padded(run_bytes)
+	results = []
+	while pos < len(data):
+		kind, name_bytes, params_bytes, storage_bits, instructions, correct, incorrect, target_correct = \
+			struct.unpack("<IIQQQQQQ", data[pos:pos + 56])
+		pos += 56
+		name = data[pos:pos + name_bytes].decode()
+		pos += padded(name_bytes)
+		params = json.loads(data[pos:pos + params_bytes].decode())
+		pos += padded(params_bytes)
+		known = instructions != NONE and instructions > 0
+		results.append({
+			"schema": version, "run": run, "kind": "btb" if kind == 1 else "branch", "name": name,
+			"params": params, "storage_bits": None if storage_bits == NONE else storage_bits,
+			"instructions": None if instructions == NONE else instructions,
+			"correct": correct, "incorrect": incorrect,
+			"mpki": incorrect / (instructions / 1000.0) if known else None,
+			"target_correct": None if target_correct == NONE else target_correct})
+	return results
+
+if __name__ == "__main__":
+	print("run,kind,name,storage_bits,mpki")
+	for filename in sys.argv[1:]:
+		for r in read_results(filename):
+			print("%s,%s,%s,%s,%s" % (r["run"], r["kind"], r["name"],
+				"" if r["storage_bits"] is None else r["storage_bits"],
+				"" if r["mpki"] is None else "%.6f" % r["mpki"]))
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Measure the slowdown of cslab_branch over native execution for one benchmark.
+# Every extra argument is a set of tool knobs to compare, e.g.:
+#
+#   ./run_slowdown.sh 429.mcf "" "-buffered 1"
+#
+# runs 429.mcf natively, with the default tool and with -buffered 1, and
+# prints the wall-clock time and slowdown of each run.
+
+# Paths come from the environment, there are no defaults for Pin and the inputs:
+#   PIN_ROOT    the Pin kit, e.g. .../pin-external-3.31-98869-gfa6f126a8-gcc-linux
+#   inputBase   the spec_execs_train_inputs directory (one folder per benchmark, with a speccmds.cmd)
+
+here="$(cd "$(dirname "$0")" && pwd)"
+
+PIN_EXE="${PIN_EXE:-${PIN_ROOT:?set PIN_ROOT to the Pin kit directory}/pin}"
+PIN_TOOL="${PIN_TOOL:-$here/pintool/obj-intel64/cslab_branch.so}"
+# Output directory for PIN's output, created if needed
+outDir="${outDir:-$here/outputs_slowdown}"
+inputBase="${inputBase:?set inputBase to the spec_execs_train_inputs directory}"
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <benchmark> [\"<knobs>\" ...]"
+    exit 1
+fi
+
+BENCH="$1"
+shift
+mkdir -p "$outDir" || exit 1
+folder="$inputBase/$BENCH"
+cd "$folder" || { echo "Failed to enter $folder"; exit 1; }
+
+# Same command extraction as run_train_predictors.sh
+line=$(head -n 1 speccmds.cmd)
+clean_cmd=$(echo "$line" | sed -n 's/.*\(\.\/.*\)/\1/p')
+
+# Wall-clock seconds of a command
+run_timed() {
+    local start end
+    start=$(date +%s.%N)
+    /bin/bash -c "$1" 1> stdout.log 2> stderr.log
+    end=$(date +%s.%N)
+    echo "$end - $start" | bc
+}
+
+native=$(run_timed "$clean_cmd")
+printf "%-30s %10.2fs\n" "native" "$native"
+
+i=0
+for knobs in "$@"; do
+    pinOutFile="$outDir/${BENCH}.slowdown.$i.out"
+    t=$(run_timed "$PIN_EXE -t $PIN_TOOL -o $pinOutFile $knobs -- $clean_cmd")
+    printf "%-30s %10.2fs  slowdown %6.1fx\n" "${knobs:-default}" "$t" "$(echo "$t / $native" | bc -l)"
+    i=$((i + 1))
+done
@@ -1,56 +1,31 @@
 #!/bin/bash
 # RUN TRAIN STATS
-
-# Absolute paths for PIN executable and tool:
-PIN_EXE="/home/john/Adv_Comp_Arch/pin-external-3.31-98869-gfa6f126a8-gcc-linux/pin"
-PIN_TOOL="/home/john/Adv_Comp_Arch/advcomparch-ex1-helpcode/pintool/obj-intel64/cslab_branch_stats.so"
-# Output directory for PIN's output -- BE CAREFUL! THE PATH NEEDS TO EXIST!!!
-outDir="/home/john/Adv_Comp_Arch/advcomparch-ex1-helpcode/outputs_stats/train"
-# Base directory that contains all benchmark folders (This is the directory where all the benchmark folders are)
-inputBase="/home/john/Adv_Comp_Arch/advcomparch-ex1-helpcode/spec_execs_train_inputs"
-
-
-# Loop over every subfolder in the input base directory.
-# By uncommenting the respective lines below you can run either only one benchmark or all benchmarks inside a directory
-# Uncomment following line (and "done" at the end of loop) for looping
-for folder in "$inputBase"/*; do
-
-# Uncomment following line to check only 403.gcc (also comment the "done" at the end of the loop). Give the benchmark folder name as the first argument when running
-#folder="$inputBase/$1" # $1 is the first argument
-    if [ -d "$folder" ]; then
-        BENCH=$(basename "$folder")
-        (
-            cd "$folder" || { echo "Failed to enter $folder"; exit 1; }
-
-            echo "=============================================="
-            echo "Contents of speccmds.cmd for $BENCH:"
-            echo "----------------------------------------------"
-            # display only the first line
-            head -n 1 speccmds.cmd
-            echo "=============================================="
-            echo ""
-
-	    # Old speccmds.cmd where mutliple lines (new ones are only 1 line). Read the first line from speccmds.cmd
-            line=$(head -n 1 speccmds.cmd)
-
-            # Old speccmds.cmd has arguments before the ./ execution. We don't want these. Extract everything from the first occurrence of "./", including "./"
-            clean_cmd=$(echo "$line" | sed -n 's/.*\(\.\/.*\)/\1/p')
-
-            # PIN output file
-            pinOutFile="$outDir/${BENCH}.cslab_branch_stats_train.out"
-
-            # Construct the complete PIN command.
-            pin_cmd="$PIN_EXE -t $PIN_TOOL -o $pinOutFile -- $clean_cmd 1> stdout.log 2> stderr.log"
-            echo "PIN_CMD: $pin_cmd"
-
-            # Execute the command while measuring time; timing output goes to a log file.
-            { /bin/bash -c "$pin_cmd" ; }
-	        # You can also measure execution time if you run it like this: 
-            # { time /bin/bash -c "$pin_cmd" ; } &> "$outDir/${BENCH}_timing.log"
-        ) &
-    fi
-done
-
-wait
+#
+# Runs cslab_branch_stats over every benchmark folder of inputBase with
+# pintool/cslab_batch: as many benchmarks at a time as there are CPUs, the
+# longest first, with the time of every run in $outDir/cslab_branch_stats_train.state.
+# Run it again after an interrupt or a failure, it continues with the
+# benchmarks that are not done. Extra arguments go to cslab_batch, e.g.
+#
+#   ./run_train_stats.sh -j 8            at most 8 benchmarks at a time
+#   ./run_train_stats.sh -mem 4096       also as many as fit in memory, 4 GB each at first
+#   ./run_train_stats.sh 403.gcc         only 403.gcc
+#
+# Paths come from the environment, there are no defaults for Pin and the inputs:
+#   PIN_ROOT    the Pin kit, e.g. .../pin-external-3.31-98869-gfa6f126a8-gcc-linux
+#   inputBase   the spec_execs_train_inputs directory (one folder per benchmark, with a speccmds.cmd)
+
+here="$(cd "$(dirname "$0")" && pwd)"
+
+PIN_EXE="${PIN_EXE:-${PIN_ROOT:?set PIN_ROOT to the Pin kit directory}/pin}"
+PIN_TOOL="${PIN_TOOL:-$here/pintool/obj-intel64/cslab_branch_stats.so}"
+BATCH="${BATCH:-$here/pintool/obj-intel64/cslab_batch}"
+# Tool knobs, e.g. TOOL_KNOBS="-threads 1"
+TOOL_KNOBS="${TOOL_KNOBS:-}"
+# Output directory for PIN's output, created if needed
+outDir="${outDir:-$here/outputs_stats/train}"
+inputBase="${inputBase:?set inputBase to the spec_execs_train_inputs directory}"
+
+"$BATCH" -pin "$PIN_EXE" -t "$PIN_TOOL" -inputs "$inputBase" -o "$outDir" \
+         -name cslab_branch_stats_train -knobs "$TOOL_KNOBS" "$@" || exit $?
 echo "Train Stats. All benchmarks done."
-
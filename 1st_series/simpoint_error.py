@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+# MPKI error of SimPoint-sampled runs (cslab_branch -simpoints) against the
+# full runs of the same benchmarks.
+#
+# Usage: simpoint_error.py <sampled outputs dir> <full outputs dir>
+#
+# The files are matched by benchmark, the part of the name before
+# ".cslab_branch" (e.g. 403.gcc), and the predictors by name.
+
+import os
+import sys
+
+def read_mpki(filename):
+	total_ins = None
+	mpki = {}
+	section = None
+	for line in open(filename):
+		tokens = line.split()
+		if line.startswith("Total Instructions:"):
+			total_ins = int(tokens[2])
+		elif line.startswith("Branch Predictors:"):
+			section = "branch"
+		elif not line.startswith("  "):
+			section = None
+		elif section == "branch" and total_ins:
+			name = line.split(':')[0].strip()
+			mpki[name] = int(tokens[-1]) / (total_ins / 1000.0)
+	return mpki
+
+def benchmark(filename):
+	return filename.split(".cslab_branch")[0]
+
+if len(sys.argv) != 3:
+	print("Usage: %s <sampled outputs dir> <full outputs dir>" % sys.argv[0])
+	sys.exit(1)
+
+sampled_dir, full_dir = sys.argv[1], sys.argv[2]
+full_files = dict((benchmark(f), f) for f in os.listdir(full_dir) if f.endswith(".out"))
+
+errors = []
+for f in sorted(os.listdir(sampled_dir)):
+	if not f.endswith(".out"):
+		continue
+	bench = benchmark(f)
+	if bench not in full_files:
+		print("%s: no full run in %s, skipped" % (f, full_dir))
+		continue
+
+	sampled = read_mpki(os.path.join(sampled_dir, f))
+	full = read_mpki(os.path.join(full_dir, full_files[bench]))
+	print(bench)
+	print("  %-24s %10s %10s %10s %8s" % ("Predictor", "Full", "Sampled", "Abs.err", "Rel.err"))
+	for name in full:
+		if name not in sampled:
+			continue
+		abs_err = abs(sampled[name] - full[name])
+		rel_err = abs_err / full[name] * 100 if full[name] > 0 else 0.0
+		errors.append(rel_err)
+		print("  %-24s %10.3f %10.3f %10.3f %7.2f%%" % (name, full[name], sampled[name], abs_err, rel_err))
+
+if errors:
+	print("Mean relative MPKI error: %.2f%% (max %.2f%%, %d predictors)"
+	      % (sum(errors) / len(errors), max(errors), len(errors)))